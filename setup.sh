@@ -4,6 +4,7 @@ cd src/protobuf
 protoc --cpp_out=. cache_index.proto
 protoc --cpp_out=. labels.proto
 protoc --cpp_out=. vector_tile.proto
+protoc --cpp_out=. triangulation.proto
 protoc --cpp_out=. xyz.proto
 cd ../..
 
@@ -0,0 +1,28 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+uniform sampler2D atlas;
+varying highp vec2 fragTexCoord;
+varying mediump vec4 fragColor;
+
+void main(void)
+{
+    // Colors are premultiplied by their alpha, and the atlas only holds the
+    // coverage of text.
+    gl_FragColor = fragColor * texture2D(atlas, fragTexCoord).a;
+}
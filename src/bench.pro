@@ -0,0 +1,72 @@
+#   Panoramix - 3D view of your surroundings.
+#   Copyright (C) 2017  Guillaume Endignoux
+#
+#   This program is free software: you can redistribute it and/or modify
+#   it under the terms of the GNU General Public License as published by
+#   the Free Software Foundation, either version 3 of the License, or
+#   (at your option) any later version.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+#
+#   You should have received a copy of the GNU General Public License
+#   along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+
+# Standalone benchmark of the triangulation pipeline (no GUI).
+
+QT -= core gui
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+QMAKE_CXXFLAGS += -std=c++14
+
+QMAKE_CXXFLAGS_RELEASE = -Ofast
+
+TEMPLATE = app
+TARGET = bench
+
+# TODO: you must adapt this to your config
+INCLUDEPATH += . \
+    /home/travis/asio-1.10.8/include/
+
+DEFINES += ASIO_STANDALONE
+
+# TODO: you must adapt this to your config
+LIBS += -L/usr/local/lib/ -lprotobuf
+
+HEADERS += \
+    config.hpp \
+    geometry/astro.hpp \
+    geometry/delaunay.hpp \
+    geometry/point.hpp \
+    geometry/primitives.hpp \
+    geometry/quadtree.hpp \
+    geometry/simplifier.hpp \
+    geometry/streamingdelaunay.hpp \
+    geometry/tilepoint.hpp \
+    geometry/triangulate.hpp \
+    geometry/visibility.hpp \
+    protobuf/cache_index.pb.h \
+    protobuf/xyz.pb.h \
+    util/concurrency.hpp \
+    util/mappedfile.hpp \
+    util/timer.hpp \
+
+SOURCES += \
+    bench/delaunaybench.cpp \
+    geometry/astro.cpp \
+    geometry/delaunay.cpp \
+    geometry/point.cpp \
+    geometry/primitives.cpp \
+    geometry/quadtree.cpp \
+    geometry/simplifier.cpp \
+    geometry/streamingdelaunay.cpp \
+    geometry/tilepoint.cpp \
+    geometry/triangulate.cpp \
+    geometry/visibility.cpp \
+    protobuf/cache_index.pb.cc \
+    protobuf/xyz.pb.cc \
+    util/concurrency.cpp \
+    util/mappedfile.cpp
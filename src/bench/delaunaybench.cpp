@@ -0,0 +1,722 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+
+// Benchmark of the triangulation pipeline on recorded and synthetic points.
+//
+// Usage:
+//   bench [max_points] [cache_folder]
+//       Run all cases, each one in a separate process so that peak memory is
+//       measured independently.  Larger sizes of a distribution are skipped
+//       once it runs out of points; crashes and errors of a case are
+//       reported, and make the exit status non-zero.
+//   bench --case <distribution> <points> <mode> [cache_folder]
+//       Run a single case, with mode "serial", "parallel", "insert",
+//       "stitch", "unsorted" (serial, without Morton reordering), "integer"
+//       (parallel, on TilePoint coordinates with exact predicates), "brio"
+//       (incremental backend), "stream" (out-of-core, by columns of tiles)
+//       "simplify" (simplification of the terrain for rendering) or
+//       "visibility" (ray casting from the center to labels).
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "config.hpp"
+#include "geometry/delaunay.hpp"
+#include "geometry/simplifier.hpp"
+#include "geometry/streamingdelaunay.hpp"
+#include "geometry/tilepoint.hpp"
+#include "geometry/visibility.hpp"
+#include "protobuf/cache_index.pb.h"
+#include "protobuf/xyz.pb.h"
+#include "util/timer.hpp"
+
+// Synthetic views span 16 x 16 tiles at zoom 14, like a typical panorama.
+static constexpr int SYNTHETIC_ZOOM = 14;
+static constexpr int SYNTHETIC_EXTENT = 16 * 4096;
+
+static constexpr char const* DISTRIBUTIONS[] = {"uniform", "clustered", "contour", "terrain", "duplicate", "deep", "cache"};
+static constexpr int SIZES[] = {10000, 100000, 1000000, 10000000};
+static constexpr char const* MODES[] = {"serial", "parallel", "insert", "stitch", "unsorted", "integer", "brio", "stream", "simplify", "visibility"};
+
+// In "insert" mode, points arrive in batches like tiles in WorldModel: the
+// first batch is triangulated, the others are inserted.
+static constexpr int INSERT_BATCHES = 16;
+
+// In "stitch" mode, points are triangulated per tile at SYNTHETIC_ZOOM before
+// the timer starts, as if loaded from the cache, and only stitching is timed.
+
+// Size of the FIFO vertex cache simulated to compute the ACMR (average cache
+// miss ratio: transformed vertices per triangle) of the index buffer, typical
+// of the post-transform cache of GPUs.
+static constexpr int VERTEX_CACHE_SIZE = 32;
+
+// Number of random points located in the triangulation, as candidate labels.
+static constexpr int LOCATE_QUERIES = 1 << 16;
+
+// Exit status of a case that used all the available points.
+static constexpr int EXIT_EXHAUSTED = 2;
+
+// Convert tile coordinates to Mercator coordinates, as in WorldModel::load().
+static Point fromTile(int zoom, int x, int y, int z)
+{
+    double scale = 1.0 / (4096.0 * (1 << zoom));
+    return Point(x * scale, y * scale, z);
+}
+
+static std::vector<Point> genUniform(int n, std::mt19937& gen)
+{
+    std::uniform_int_distribution<int> coord(0, SYNTHETIC_EXTENT - 1);
+    std::uniform_int_distribution<int> ele(0, 4000);
+
+    std::vector<Point> points;
+    points.reserve(n);
+    for (int i = 0 ; i < n ; ++i)
+        points.push_back(fromTile(SYNTHETIC_ZOOM, coord(gen), coord(gen), ele(gen)));
+    return points;
+}
+
+static std::vector<Point> genClustered(int n, std::mt19937& gen)
+{
+    static constexpr int CLUSTERS = 100;
+    std::uniform_int_distribution<int> coord(0, SYNTHETIC_EXTENT - 1);
+    std::uniform_int_distribution<int> cluster(0, CLUSTERS - 1);
+    std::normal_distribution<double> spread(0, SYNTHETIC_EXTENT / 64.0);
+    std::uniform_int_distribution<int> ele(0, 4000);
+
+    std::vector<std::pair<int, int>> centers;
+    for (int i = 0 ; i < CLUSTERS ; ++i)
+        centers.emplace_back(coord(gen), coord(gen));
+
+    std::vector<Point> points;
+    points.reserve(n);
+    while ((int)points.size() < n)
+    {
+        auto& c = centers[cluster(gen)];
+        int x = c.first + std::lround(spread(gen));
+        int y = c.second + std::lround(spread(gen));
+        if (x < 0 || x >= SYNTHETIC_EXTENT || y < 0 || y >= SYNTHETIC_EXTENT)
+            continue;
+        points.push_back(fromTile(SYNTHETIC_ZOOM, x, y, ele(gen)));
+    }
+    return points;
+}
+
+// Straight contour lines with integer steps, so that many points are exactly
+// colinear, which stresses degenerate cases of the predicates.
+static std::vector<Point> genContour(int n, std::mt19937& gen)
+{
+    static constexpr int POINTS_PER_LINE = 2000;
+    std::uniform_int_distribution<int> coord(0, SYNTHETIC_EXTENT - 1);
+    std::uniform_int_distribution<int> step(1, 8);
+    std::uniform_int_distribution<int> slope(-3, 3);
+    std::uniform_int_distribution<int> ele(0, 4000);
+
+    std::vector<Point> points;
+    points.reserve(n);
+    while ((int)points.size() < n)
+    {
+        int x = coord(gen);
+        int y = coord(gen);
+        int dy = slope(gen);
+        int z = ele(gen);
+        for (int i = 0 ; i < POINTS_PER_LINE && (int)points.size() < n ; ++i)
+        {
+            int s = step(gen);
+            x += s;
+            y += s * dy;
+            if (x < 0 || x >= SYNTHETIC_EXTENT || y < 0 || y >= SYNTHETIC_EXTENT)
+                break;
+            points.push_back(fromTile(SYNTHETIC_ZOOM, x, y, z));
+        }
+    }
+    return points;
+}
+
+// Contour lines every 20 meters of a smooth relief of Gaussian hills, as in
+// the terrain tiles.  Neighboring lines are close on slopes and far apart on
+// plateaus.
+static std::vector<Point> genTerrain(int n, std::mt19937& gen)
+{
+    static constexpr int HILLS = 20;
+    static constexpr double INTERVAL = 20;
+    static constexpr int POINTS_PER_LINE = 500;
+    std::uniform_real_distribution<double> coord(0, SYNTHETIC_EXTENT);
+    std::uniform_real_distribution<double> radius(SYNTHETIC_EXTENT / 32.0, SYNTHETIC_EXTENT / 8.0);
+    std::uniform_real_distribution<double> height(100, 1500);
+    std::uniform_real_distribution<double> step(4, 16);
+
+    struct Hill {
+        double x;
+        double y;
+        double radius;
+        double height;
+    };
+    std::vector<Hill> hills;
+    for (int i = 0 ; i < HILLS ; ++i)
+        hills.push_back({coord(gen), coord(gen), radius(gen), height(gen)});
+
+    // Elevation and its gradient.
+    auto relief = [&hills](double x, double y, double& gx, double& gy) {
+        double z = 0;
+        gx = gy = 0;
+        for (auto& hill : hills)
+        {
+            double dx = x - hill.x;
+            double dy = y - hill.y;
+            double r2 = hill.radius * hill.radius;
+            double e = hill.height * std::exp(-(dx*dx + dy*dy) / (2 * r2));
+            z += e;
+            gx -= e * dx / r2;
+            gy -= e * dy / r2;
+        }
+        return z;
+    };
+
+    std::vector<Point> points;
+    points.reserve(n);
+    while ((int)points.size() < n)
+    {
+        double x = coord(gen);
+        double y = coord(gen);
+        double gx, gy;
+        double level = std::round(relief(x, y, gx, gy) / INTERVAL) * INTERVAL;
+        for (int i = 0 ; i < POINTS_PER_LINE && (int)points.size() < n ; ++i)
+        {
+            // Back to the contour line along the gradient, then along the line.
+            double z = relief(x, y, gx, gy);
+            double g2 = gx*gx + gy*gy;
+            if (g2 < 1e-9)
+                break;
+            x += (level - z) * gx / g2;
+            y += (level - z) * gy / g2;
+            if (x < 0 || x >= SYNTHETIC_EXTENT || y < 0 || y >= SYNTHETIC_EXTENT)
+                break;
+            points.push_back(fromTile(SYNTHETIC_ZOOM, std::lround(x), std::lround(y), level));
+
+            double s = step(gen) / std::sqrt(g2);
+            x -= s * gy;
+            y += s * gx;
+        }
+    }
+    return points;
+}
+
+// Each location appears 4 times, as on the borders of overlapping tiles.
+static std::vector<Point> genDuplicate(int n, std::mt19937& gen)
+{
+    std::vector<Point> points = genUniform((n + 3) / 4, gen);
+    points.reserve(4 * points.size());
+    for (int k = 1 ; k < 4 ; ++k)
+        for (int i = 0 ; i < n / 4 ; ++i)
+            points.push_back(points[i]);
+    points.resize(n);
+    std::shuffle(points.begin(), points.end(), gen);
+    return points;
+}
+
+// Whether WorldModel::load() accepts a tile: beyond INTEGER_ZOOM, integer
+// coordinates would not be exact.
+static bool acceptTile(int zoom, int x, int y)
+{
+    if (TilePoint::tileScale(zoom))
+        return true;
+    std::cerr << "Zoom too large: " << zoom << ", " << x << ", " << y << std::endl;
+    return false;
+}
+
+// Tiles alternately at INTEGER_ZOOM and one level deeper, along a row.
+// Deeper tiles are rejected, and only the others give points.
+static std::vector<Point> genDeep(int n, std::mt19937& gen)
+{
+    static constexpr int TILES = 16;
+    std::uniform_int_distribution<int> coord(0, 4095);
+    std::uniform_int_distribution<int> ele(0, 4000);
+    int tilePoints = std::max(1, n / TILES);
+
+    std::vector<Point> points;
+    points.reserve(n);
+    for (int k = 0 ; (int)points.size() < n ; ++k)
+    {
+        int zoom = INTEGER_ZOOM + k % 2;
+        int x = (1 << (zoom - 1)) + k;
+        int y = 1 << (zoom - 1);
+        if (!acceptTile(zoom, x, y))
+            continue;
+        for (int i = 0 ; i < tilePoints && (int)points.size() < n ; ++i)
+            points.push_back(fromTile(zoom, x*4096 + coord(gen), y*4096 + coord(gen), ele(gen)));
+    }
+    return points;
+}
+
+// Points from the recorded XYZ tiles of the cache, as in WorldModel::load().
+static std::vector<Point> loadCache(int n, const std::string& folder)
+{
+    std::vector<Point> points;
+
+    panoramix::CacheIndex index;
+    std::ifstream ifs(folder + "/" + INDEX_FILE, std::ifstream::binary);
+    if (!index.ParseFromIstream(&ifs))
+    {
+        std::cerr << "Cannot read cache index in " << folder << std::endl;
+        return points;
+    }
+
+    for (auto& f : index.files())
+    {
+        int zoom, x, y;
+        char ext[8];
+        if (std::sscanf(f.name().c_str(), "%d-%d-%d.%7s", &zoom, &x, &y, ext) != 4 || std::string(ext) != "xyz")
+            continue;
+        if (!acceptTile(zoom, x, y))
+            continue;
+
+        panoramix::XYZ xyz;
+        std::ifstream tile(folder + "/" + f.name(), std::ifstream::binary);
+        if (!xyz.ParseFromIstream(&tile))
+            continue;
+
+        for (int i = 0 ; i+2 < xyz.points_size() && (int)points.size() < n ; i+=3)
+            points.push_back(fromTile(zoom, x*4096 + xyz.points(i), y*4096 + xyz.points(i+1), xyz.points(i+2)));
+        if ((int)points.size() >= n)
+            break;
+    }
+
+    return points;
+}
+
+template <typename P>
+static std::vector<typename BasicDelaunay<P>::Fragment> makeFragments(std::vector<P>&& points)
+{
+    double zz = 1 << SYNTHETIC_ZOOM;
+    std::map<std::pair<long, long>, std::vector<P>> tiles;
+    for (auto& p : points)
+    {
+        Point q = Mercator<P>::to(p);
+        tiles[std::make_pair(std::floor(q.x * zz), std::floor(q.y * zz))].push_back(p);
+    }
+    points.clear();
+
+    std::vector<typename BasicDelaunay<P>::Fragment> fragments;
+    for (auto& tile : tiles)
+    {
+        fragments.push_back(BasicDelaunay<P>::makeFragment(std::move(tile.second)));
+        typename BasicDelaunay<P>::Fragment& fragment = fragments.back();
+        P min = Mercator<P>::from(Point(tile.first.first / zz, tile.first.second / zz));
+        P max = Mercator<P>::from(Point((tile.first.first + 1) / zz, (tile.first.second + 1) / zz));
+        fragment.minx = min.x;
+        fragment.miny = min.y;
+        fragment.maxx = max.x;
+        fragment.maxy = max.y;
+    }
+    return fragments;
+}
+
+// Transformed vertices per triangle, for indices in the order of
+// WorldModel::makeMesh().
+template <typename P>
+static double computeACMR(const BasicDelaunay<P>& delaunay)
+{
+    std::vector<long> cache(VERTEX_CACHE_SIZE, -1);
+    int head = 0;
+    long misses = 0;
+    unsigned int triangleCount = delaunay.iterTrianglesIndices([&](unsigned int a, unsigned int b, unsigned int c){
+        for (long v : {a, c, b})
+        {
+            if (std::find(cache.begin(), cache.end(), v) != cache.end())
+                continue;
+            ++misses;
+            cache[head] = v;
+            head = (head + 1) % VERTEX_CACHE_SIZE;
+        }
+    });
+    return triangleCount ? static_cast<double>(misses) / triangleCount : 0;
+}
+
+static double peakMemoryMB()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+static void printHeader()
+{
+    std::cout << std::left << std::setw(10) << "data"
+              << std::setw(9) << "mode"
+              << std::right
+              << std::setw(10) << "size"
+              << std::setw(10) << "unique"
+              << std::setw(9) << "dedup"
+              << std::setw(9) << "order"
+              << std::setw(9) << "divconq"
+              << std::setw(9) << "finalize"
+              << std::setw(9) << "quadtree"
+              << std::setw(9) << "insert"
+              << std::setw(9) << "stitch"
+              << std::setw(9) << "reorder"
+              << std::setw(9) << "total"
+              << std::setw(9) << "Mpts/s"
+              << std::setw(9) << "B/tri"
+              << std::setw(9) << "normals"
+              << std::setw(9) << "locate"
+              << std::setw(9) << "ACMR"
+              << std::setw(9) << "peak MB"
+              << std::endl;
+}
+
+template <typename Timings>
+static void printRow(const std::string& distribution, const std::string& mode, int size, size_t pointCount, const Timings& t,
+                     double total, double triangleBytes, double normals, double locate, double acmr)
+{
+    std::cout << std::fixed << std::setprecision(3)
+              << std::left << std::setw(10) << distribution
+              << std::setw(9) << mode
+              << std::right
+              << std::setw(10) << size
+              << std::setw(10) << pointCount
+              << std::setw(9) << t.dedup
+              << std::setw(9) << t.order
+              << std::setw(9) << t.divconq
+              << std::setw(9) << t.finalize
+              << std::setw(9) << t.quadtree
+              << std::setw(9) << t.insert
+              << std::setw(9) << t.stitch
+              << std::setw(9) << t.reorder
+              << std::setw(9) << total
+              << std::setw(9) << size / total / 1e6
+              << std::setw(9) << std::setprecision(1) << triangleBytes
+              << std::setw(9) << std::setprecision(3) << normals
+              << std::setw(9) << locate
+              << std::setw(9) << acmr
+              << std::setw(9) << std::setprecision(1) << peakMemoryMB()
+              << std::endl;
+}
+
+// Triangulates the points with the given mode and prints one line of results.
+template <typename P>
+static void measure(std::vector<P>&& points, const std::string& distribution, const std::string& mode, std::mt19937& gen)
+{
+    bool parallel = mode != "serial" && mode != "unsorted";
+    bool reorder = mode != "unsorted";
+    bool insert = mode == "insert";
+    bool stitch = mode == "stitch";
+    int size = points.size();
+
+    typename BasicDelaunay<P>::Options options;
+    options.parallel = parallel;
+    options.reorder = reorder;
+    if (mode == "brio")
+        options.backend = BasicDelaunay<P>::Options::INCREMENTAL;
+
+    std::vector<std::vector<P>> batches;
+    if (insert)
+    {
+        for (int i = INSERT_BATCHES - 1 ; i > 0 ; --i)
+        {
+            auto begin = points.begin() + static_cast<long>(size) * i / INSERT_BATCHES;
+            batches.emplace_back(std::make_move_iterator(begin), std::make_move_iterator(points.end()));
+            points.erase(begin, points.end());
+        }
+        std::reverse(batches.begin(), batches.end());
+    }
+
+    std::vector<typename BasicDelaunay<P>::Fragment> fragments;
+    std::vector<const typename BasicDelaunay<P>::Fragment*> fragmentPtrs;
+    if (stitch)
+    {
+        fragments = makeFragments(std::move(points));
+        for (auto& fragment : fragments)
+            fragmentPtrs.push_back(&fragment);
+    }
+
+    Timer timer;
+    BasicDelaunay<P> delaunay = stitch ? BasicDelaunay<P>(std::move(fragmentPtrs), options) : BasicDelaunay<P>(std::move(points), options);
+    typename BasicDelaunay<P>::Timings t = delaunay.timings();
+    for (auto& batch : batches)
+    {
+        delaunay.insert(std::move(batch));
+        t.insert += delaunay.timings().insert;
+        t.finalize += delaunay.timings().finalize;
+        t.reorder += delaunay.timings().reorder;
+        t.quadtree = delaunay.timings().quadtree;
+    }
+    double total = timer.elapsed();
+    unsigned int triangleCount = delaunay.iterTrianglesIndices([](unsigned int, unsigned int, unsigned int){});
+
+    // Walk around each vertex, as WorldModel::makeMesh() does for normals.
+    timer.restart();
+    std::vector<Point> mercator;
+    delaunay.iterPoints([&mercator](const Point& p){ mercator.push_back(p); });
+    delaunay.iterNormals(mercator, [](const Point&){});
+    double normals = timer.elapsed();
+    double acmr = computeACMR(delaunay);
+
+    // Locate random points, as labels of the view.
+    std::vector<Point> queries;
+    std::uniform_int_distribution<size_t> pick(0, mercator.size() - 1);
+    for (int i = 0 ; i < LOCATE_QUERIES ; ++i)
+        queries.push_back((mercator[pick(gen)] + mercator[pick(gen)]) / 2.0);
+    std::vector<double> heights(queries.size());
+    timer.restart();
+    delaunay.findTrianglePoints(queries.data(), queries.size(), heights.data());
+    double locate = timer.elapsed();
+
+    printRow(distribution, mode, size, delaunay.points().size(), t, total,
+             (double)delaunay.triangleMemory() / triangleCount, normals, locate, acmr);
+}
+
+// In "stream" mode, columns of tiles at SYNTHETIC_ZOOM are triangulated out of
+// core, into files of the current folder that are removed afterwards.  The
+// size of triangles is the peak of triangles in memory over all triangles.
+static constexpr char const* STREAM_PATH = "bench-stream";
+
+static bool measureStream(std::vector<Point>&& points, const std::string& distribution, const std::string& mode)
+{
+    int size = points.size();
+    double zz = 1 << SYNTHETIC_ZOOM;
+    std::map<long, std::vector<Point>> columns;
+    for (auto& p : points)
+        columns[std::floor(p.x * zz)].push_back(p);
+    points = std::vector<Point>();
+
+    Timer timer;
+    StreamingDelaunay<Point> delaunay(STREAM_PATH);
+    int activeCount = 0;
+    bool ok = true;
+    for (auto it = columns.begin() ; ok && it != columns.end() ; ++it)
+    {
+        auto next = std::next(it);
+        double nextx = next == columns.end() ? std::numeric_limits<double>::infinity() : next->first / zz;
+        ok = delaunay.addColumn(std::move(it->second), nextx);
+        it->second = std::vector<Point>();
+        activeCount = std::max(activeCount, delaunay.activeTriangleCount());
+    }
+    ok = delaunay.finish() && ok;
+    double total = timer.elapsed();
+
+    std::remove((std::string(STREAM_PATH) + ".points").c_str());
+    std::remove((std::string(STREAM_PATH) + ".triangles").c_str());
+    if (!ok)
+        return false;
+
+    printRow(distribution, mode, size, delaunay.pointCount(), Delaunay::Timings(), total,
+             (double)activeCount * sizeof(Triangle) / delaunay.triangleCount(), 0, 0, 0);
+    return true;
+}
+
+// In "simplify" mode, the triangulation is simplified with a constant
+// tolerance in meters, and the triangulation of the simplifier is kept, as in
+// WorldModel.  Only this is timed, and the unique count is the count of points
+// kept.
+static constexpr double SIMPLIFY_TOLERANCE = 2.0;
+
+static void measureSimplify(std::vector<Point>&& points, const std::string& distribution, const std::string& mode)
+{
+    int size = points.size();
+    Delaunay delaunay(std::move(points), Delaunay::Options());
+
+    Timer timer;
+    TrianglePool pool;
+    std::vector<Point> kept = Simplifier::simplify<Point>(delaunay.points(), [](const Point&){ return SIMPLIFY_TOLERANCE; }, &pool);
+    Delaunay::Options options;
+    options.quadtree = false;
+    Delaunay simplified(std::move(kept), std::move(pool), options);
+    double total = timer.elapsed();
+    unsigned int triangleCount = simplified.iterTrianglesIndices([](unsigned int, unsigned int, unsigned int){});
+
+    printRow(distribution, mode, size, simplified.points().size(), simplified.timings(), total,
+             (double)simplified.triangleMemory() / triangleCount, 0, 0, computeACMR(simplified));
+}
+
+// In "visibility" mode, the pyramid of the terrain is built and random points
+// on the ground are tested for visibility from above the center of the view,
+// as labels in WorldModel.  Only this is timed, and the unique count is the
+// count of visible points.
+static constexpr int VISIBILITY_TARGETS = 1 << 12;
+static constexpr double VISIBILITY_EYE_HEIGHT = 10;
+
+static void measureVisibility(std::vector<Point>&& points, const std::string& distribution, const std::string& mode, std::mt19937& gen)
+{
+    int size = points.size();
+    auto delaunay = std::make_shared<const Delaunay>(std::move(points), Delaunay::Options());
+    unsigned int triangleCount = delaunay->iterTrianglesIndices([](unsigned int, unsigned int, unsigned int){});
+
+    // The first point is the eye, the other ones are targets.
+    std::vector<Point> targets;
+    std::uniform_int_distribution<int> coord(0, SYNTHETIC_EXTENT - 1);
+    targets.push_back(fromTile(SYNTHETIC_ZOOM, SYNTHETIC_EXTENT / 2, SYNTHETIC_EXTENT / 2, 0));
+    for (int i = 0 ; i < VISIBILITY_TARGETS ; ++i)
+        targets.push_back(fromTile(SYNTHETIC_ZOOM, coord(gen), coord(gen), 0));
+    std::vector<double> heights(targets.size());
+    delaunay->findTrianglePoints(targets.data(), targets.size(), heights.data());
+    for (unsigned int i = 0 ; i < targets.size() ; ++i)
+        targets[i].z = std::isnan(heights[i]) ? 0 : heights[i];
+    Point eye = targets.front() + Point(0, 0, VISIBILITY_EYE_HEIGHT);
+    targets.erase(targets.begin());
+
+    Timer timer;
+    Visibility visibility(delaunay);
+    std::vector<bool> visible = visibility.compute(eye, targets);
+    double total = timer.elapsed();
+
+    printRow(distribution, mode, size, std::count(visible.begin(), visible.end(), true), Delaunay::Timings(), total,
+             (double)delaunay->triangleMemory() / triangleCount, 0, 0, 0);
+}
+
+static int runCase(const std::string& distribution, int n, const std::string& mode, const std::string& folder)
+{
+    std::mt19937 gen(42);
+    std::vector<Point> points;
+    if (distribution == "uniform")
+        points = genUniform(n, gen);
+    else if (distribution == "clustered")
+        points = genClustered(n, gen);
+    else if (distribution == "contour")
+        points = genContour(n, gen);
+    else if (distribution == "terrain")
+        points = genTerrain(n, gen);
+    else if (distribution == "duplicate")
+        points = genDuplicate(n, gen);
+    else if (distribution == "deep")
+        points = genDeep(n, gen);
+    else if (distribution == "cache")
+        points = loadCache(n, folder);
+    else
+    {
+        std::cerr << "Unknown distribution: " << distribution << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    int size = points.size();
+    if (size < 3)
+    {
+        std::cerr << "Not enough points for " << distribution << std::endl;
+        return EXIT_EXHAUSTED;
+    }
+
+    if (mode == "stream")
+    {
+        if (!measureStream(std::move(points), distribution, mode))
+            return EXIT_FAILURE;
+    }
+    else if (mode == "simplify")
+        measureSimplify(std::move(points), distribution, mode);
+    else if (mode == "visibility")
+        measureVisibility(std::move(points), distribution, mode, gen);
+    else if (mode == "integer")
+    {
+        std::vector<TilePoint> tilePoints;
+        tilePoints.reserve(points.size());
+        for (auto& p : points)
+            tilePoints.push_back(TilePoint::fromMercator(p));
+        points = std::vector<Point>();
+        measure(std::move(tilePoints), distribution, mode, gen);
+    }
+    else
+        measure(std::move(points), distribution, mode, gen);
+
+    return size < n ? EXIT_EXHAUSTED : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    if (argc >= 5 && std::string(argv[1]) == "--case")
+        return runCase(argv[2], std::atoi(argv[3]), argv[4], argc >= 6 ? argv[5] : CACHE_FOLDER);
+
+    int maxPoints = argc >= 2 ? std::atoi(argv[1]) : SIZES[3];
+    std::string folder = argc >= 3 ? argv[2] : CACHE_FOLDER;
+
+    int failures = 0;
+    printHeader();
+    for (auto distribution : DISTRIBUTIONS)
+    {
+        for (int n : SIZES)
+        {
+            if (n > maxPoints)
+                break;
+
+            bool exhausted = false;
+            for (auto mode : MODES)
+            {
+                std::ostringstream cmd;
+                // The shell is replaced, so that signals reach the status.
+                cmd << "exec '" << argv[0] << "' --case " << distribution << " " << n << " " << mode << " '" << folder << "'";
+
+                FILE* child = popen(cmd.str().c_str(), "r");
+                if (!child)
+                {
+                    std::cerr << "Cannot run case " << distribution << " " << n << " " << mode << std::endl;
+                    return EXIT_FAILURE;
+                }
+
+                char line[256];
+                while (std::fgets(line, sizeof(line), child))
+                    std::cout << line << std::flush;
+
+                // Larger sizes are skipped only once a case used all the
+                // available points.
+                int status = pclose(child);
+                if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+                    continue;
+                if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_EXHAUSTED)
+                {
+                    exhausted = true;
+                    continue;
+                }
+
+                ++failures;
+                std::cerr << "Case " << distribution << " " << n << " " << mode << " failed: ";
+                if (status == -1)
+                    std::cerr << "cannot get its status";
+                else if (WIFSIGNALED(status))
+                    std::cerr << "signal " << WTERMSIG(status) << " (" << strsignal(WTERMSIG(status)) << ")";
+                else
+                    std::cerr << "exit status " << WEXITSTATUS(status);
+                std::cerr << std::endl;
+            }
+
+            if (exhausted)
+                break;
+        }
+    }
+
+    if (failures)
+    {
+        std::cerr << failures << " case(s) failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
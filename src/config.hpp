@@ -25,6 +25,10 @@ static constexpr char CACHE_FOLDER[] = "data/";
 // Filename for labels inside CACHE_FOLDER.
 static constexpr char LABELS_FILE[] = "labels";
 
+// Filename inside CACHE_FOLDER for the labels of LABELS_FILE converted to the
+// compact format that is mapped in memory.
+static constexpr char LABELS_MAPPED_FILE[] = "labels.mapped";
+
 // Filename for index inside CACHE_FOLDER.
 static constexpr char INDEX_FILE[] = "index";
 
@@ -43,22 +47,22 @@ static constexpr char MAPBOX_DOMAIN[] = "a.tiles.mapbox.com";
 // Source for API tile requests.
 static constexpr char MAPBOX_SOURCE[] = "mapbox.mapbox-terrain-v2";
 
-// For some reason retina displays on MacOS have twice more pixel resolution
-// than coordinates on screen.  For example, a window of dimensions 1000 x 500
-// has 2000 x 1000 pixels.  This constant is here to correctly convert between
-// screen coordinates and indices in pixel arrays.  Put "2" on retina displays
-// and "1" on regular displays.
-static constexpr int RETINA_FACTOR = 2;
-
 // Meters above ground for an observer.
 static constexpr double VIEWER_HEIGHT = 10;
 
-// Meters above ground for depth test of peaks.
-static constexpr double PEAKS_DEPTH_HEIGHT = 100;
+// Meters above ground of the point of a label that must be in sight of the
+// eye for the label to be shown, so that the slopes just around it do not
+// hide it.
+static constexpr double LABEL_VISIBILITY_HEIGHT = 20;
 
 // Maximum number of labels to show in one view.  No limit if undefined.
 //#define MAX_LABELS_IN_VIEW 20
 
+// Maximum number of labels laid out in one frame, by priority, after the
+// labels hidden by the ones already shown.  This bounds the time spent on
+// labels when many of them are in view.
+static constexpr unsigned int MAX_LABEL_CANDIDATES = 500;
+
 // If not defined, use a simpler model of locally flat Earth.
 // Note: when enabled, the Earth is simply approximated as a sphere (instead of
 // an ellipsoid).
@@ -67,6 +71,47 @@ static constexpr double PEAKS_DEPTH_HEIGHT = 100;
 // Earth radius in meters.
 static constexpr double EARTH_RADIUS = 6.384e6;
 
+// Zoom level of the integer coordinates of terrain points (4096 units per
+// tile at this zoom).  Tiles up to this zoom are converted exactly, and
+// geometric predicates are exact for zoom levels up to 16.
+static constexpr int INTEGER_ZOOM = 16;
+
+// Tolerance in tile units (4096 per tile) of the simplification of contour
+// lines when tiles are converted to points.  Cache entries made with another
+// tolerance are downloaded again.  Put "0" to only remove colinear points.
+static constexpr double CONTOUR_TOLERANCE = 1.0;
+
+// Below this number of points, Delaunay triangulation is serial even if
+// parallel.  Splitting the divide-and-conquer into sub-pools costs 3 to 16% of
+// the serial time, and the parallel part is only a fraction of the whole
+// triangulation: around 100k points, the gain on several threads is marginal.
+static constexpr unsigned int DELAUNAY_PARALLEL_MIN_POINTS = 1 << 18;
+
+// Levels of detail of the rendered terrain.  Each tile is a chunk of the
+// mesh, simplified within MESH_MAX_ERROR meters (vertically) at the finest
+// level, and MESH_LOD_RATIO times more at each coarser level.  Each frame, a
+// chunk is drawn at the coarsest level whose error is at most MESH_LOD_PIXELS
+// pixels on screen.  Elevation queries always use all points.
+static constexpr double MESH_MAX_ERROR = 1.0;
+static constexpr int MESH_LOD_LEVELS = 4;
+static constexpr double MESH_LOD_RATIO = 4.0;
+static constexpr double MESH_LOD_PIXELS = 1.0;
+
+// Seconds per frame to upload new chunks of the mesh to the GPU (at least one
+// chunk per frame), so that loading tiles does not stall rendering.
+static constexpr double MESH_UPLOAD_BUDGET = 0.004;
+
+// Samples of elevation along each border of a chunk.  Neighboring chunks of
+// the same zoom share them, and skirts hide the cracks between levels.
+static constexpr int MESH_LOD_BORDER_SAMPLES = 64;
+
+// Visibility of labels is computed by casting rays against the terrain.  The
+// maximal elevation over tiles at VISIBILITY_GRID_ZOOM (and coarser) skips the
+// parts of rays far above the ground, and the terrain is sampled every
+// VISIBILITY_SAMPLE_STEP meters along the other parts.
+static constexpr int VISIBILITY_GRID_ZOOM = 17;
+static constexpr double VISIBILITY_SAMPLE_STEP = 20;
+
 // Enable various assert()s in geometric algorithms.
 #define ENABLE_GEOMETRIC_ASSERT
 
@@ -73,6 +73,16 @@ std::unique_ptr<std::ifstream> Cache::readLabels() const
     return std::make_unique<std::ifstream>(mFolder + "/" + LABELS_FILE, std::ifstream::binary);
 }
 
+std::string Cache::labelsPath() const
+{
+    return mFolder + "/" + LABELS_FILE;
+}
+
+std::string Cache::mappedLabelsPath() const
+{
+    return mFolder + "/" + LABELS_MAPPED_FILE;
+}
+
 std::unique_ptr<std::ifstream> Cache::read(const std::string& key)
 {
     std::lock_guard<std::mutex> lock(mMutex);
@@ -30,6 +30,8 @@ public:
     Cache(const std::string& folder);
 
     std::unique_ptr<std::ifstream> readLabels() const;
+    std::string labelsPath() const;
+    std::string mappedLabelsPath() const;
     std::unique_ptr<std::ifstream> read(const std::string& key);
     std::unique_ptr<std::ofstream> write(const std::string& key);
     bool has(const std::string& key) const;
@@ -25,6 +25,7 @@
 #include <iostream>
 #include <chrono>
 #include <ctime>
+#include <sys/stat.h>
 
 Database::Database(const std::string& token, const std::string& cacheFolder) :
     mToken(token),
@@ -32,13 +33,54 @@ Database::Database(const std::string& token, const std::string& cacheFolder) :
 {
 }
 
-std::unique_ptr<std::ifstream> Database::loadLabels()
+std::shared_ptr<const Labels> Database::loadLabels()
 {
-    auto ifs = mCache.readLabels();
-    if (ifs)
-        return ifs;
-
-    return std::unique_ptr<std::ifstream>();
+    // Callers wait for a single load, and then share its result.  On
+    // failure, the labels loaded before (if any) are kept.
+    std::lock_guard<std::mutex> lock(mLabelsMutex);
+    std::string path = mCache.mappedLabelsPath();
+
+    struct stat source;
+    struct stat mapped;
+    bool hasSource = !::stat(mCache.labelsPath().c_str(), &source);
+    bool hasMapped = !::stat(path.c_str(), &mapped);
+    bool converted = false;
+    auto convert = [this, &path, &mapped, &converted] {
+        auto ifs = mCache.readLabels();
+        converted = *ifs && Labels::convert(*ifs, path) && !::stat(path.c_str(), &mapped);
+        return converted;
+    };
+    if (hasSource && (!hasMapped || mapped.st_mtime < source.st_mtime))
+    {
+        if (!convert())
+            return mLabels;
+        hasMapped = true;
+    }
+    if (!hasMapped)
+        return mLabels;
+
+    // The conversion replaces the file, so that its inode changes.
+    auto versionOf = [](const struct stat& st) {
+        FileVersion version;
+        version.inode = st.st_ino;
+        version.mtime = st.st_mtime;
+        version.size = st.st_size;
+        return version;
+    };
+    if (mLabels && versionOf(mapped) == mLabelsVersion)
+        return mLabels;
+
+    // Previous labels remain mapped as long as they are in use.  A file in an
+    // older format is converted again.
+    auto labels = std::make_shared<Labels>();
+    if (!labels->open(path))
+    {
+        if (!hasSource || converted || !convert() || !labels->open(path))
+            return mLabels;
+    }
+    mLabels = std::move(labels);
+    mLabelsVersion = versionOf(mapped);
+    return mLabels;
 }
 
 std::unique_ptr<std::ifstream> Database::loadSimple(int z, int x, int y, const std::string& ext)
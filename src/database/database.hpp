@@ -25,13 +25,17 @@
 #include <asio/error_code.hpp>
 
 #include "cache.hpp"
+#include "geometry/labels.hpp"
 
 class Database
 {
 public:
     Database(const std::string& token, const std::string& cacheFolder);
 
-    std::unique_ptr<std::ifstream> loadLabels();
+    // Labels in the compact format, shared by all callers.  They are mapped
+    // on the first call, and again only when the files change (the protobuf
+    // file is converted first if it is newer).
+    std::shared_ptr<const Labels> loadLabels();
     std::unique_ptr<std::ifstream> loadSimple(int z, int x, int y, const std::string& ext);
     std::unique_ptr<std::ofstream> storeSimple(int z, int x, int y, const std::string& ext);
     void loadMvt(int z, int x, int y, const std::function<void(const std::string&)>& onSuccess, const std::function<void()>& onError);
@@ -45,6 +49,16 @@ private:
         std::function<void()> onError;
     };
 
+    // Identity of a version of a file.
+    struct FileVersion {
+        unsigned long long inode = 0;
+        long long mtime = 0;
+        long long size = 0;
+
+        inline bool operator==(const FileVersion& v) const
+            {return inode == v.inode && mtime == v.mtime && size == v.size;}
+    };
+
     void finished(const std::string& key, const std::string& content);
     void error(const std::string& key, asio::error_code ec);
 
@@ -52,6 +66,10 @@ private:
     std::string mToken;
     Cache mCache;
     std::unordered_map<std::string, Request> mRequests;
+
+    std::mutex mLabelsMutex;
+    std::shared_ptr<const Labels> mLabels;
+    FileVersion mLabelsVersion;
 };
 
 #endif // DATABASE_HPP
@@ -18,248 +18,830 @@
 
 #include "delaunay.hpp"
 #include "primitives.hpp"
+#include "util/concurrency.hpp"
+#include "util/timer.hpp"
 
 #include <algorithm>
-#include <unordered_set>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <random>
 
 #ifdef ENABLE_GEOMETRIC_ASSERT
 #include <cassert>
 #endif
 
+// Below this size, points are inserted in a single round.
+static constexpr size_t INSERT_FIRST_ROUND = 64;
 
-Delaunay::Delaunay(std::vector<Point>&& points, bool quadtree) :
-    mPoints(std::move(points))
+// After an insertion, the pool is shrunk if more than 1/INSERT_MAX_SLACK of it
+// is unused.
+static constexpr int INSERT_MAX_SLACK = 16;
+
+// Number of triangles per parallel job when finalizing.
+static constexpr int FINALIZE_CHUNK = 1 << 16;
+
+// Number of queries per parallel job when locating points.
+static constexpr unsigned int LOCATE_CHUNK = 1 << 12;
+
+// Resolution of the Morton curve used to reorder points and triangles.
+static constexpr int MORTON_BITS = 16;
+
+// Spread the lower MORTON_BITS bits of v to even positions.
+static uint32_t spreadBits(uint32_t v)
+{
+    v &= (1u << MORTON_BITS) - 1;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Index of the cell (x, y) along a Morton (Z-order) curve.
+static uint32_t mortonIndex(uint32_t x, uint32_t y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// Stable sort of items by an unsigned key of 'bits' bits, faster than
+// std::sort on millions of items.
+template <typename T, typename Key>
+static void radixSort(std::vector<T>& items, int bits, const Key& key)
+{
+    static constexpr int RADIX_BITS = 16;
+    static constexpr uint64_t RADIX_MASK = (1u << RADIX_BITS) - 1;
+
+    std::vector<T> buffer(items.size());
+    std::vector<size_t> offsets(1u << RADIX_BITS);
+    for (int shift = 0 ; shift < bits ; shift += RADIX_BITS)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        for (auto& item : items)
+            ++offsets[(key(item) >> shift) & RADIX_MASK];
+
+        size_t sum = 0;
+        for (size_t& offset : offsets)
+        {
+            size_t count = offset;
+            offset = sum;
+            sum += count;
+        }
+
+        for (auto& item : items)
+            buffer[offsets[(key(item) >> shift) & RADIX_MASK]++] = item;
+        items.swap(buffer);
+    }
+}
+
+static void radixSort(std::vector<std::pair<uint32_t, int>>& items)
+{
+    radixSort(items, 32, [](const std::pair<uint32_t, int>& item){ return item.first; });
+}
+
+
+template <typename P>
+BasicDelaunay<P>::BasicDelaunay(std::vector<P>&& points, const Options& options) :
+    mPoints(std::move(points)),
+    mOptions(options)
 {
 #ifdef ENABLE_GEOMETRIC_ASSERT
     assert(mPoints.size() >= 3);
 #endif
-    init(quadtree);
+    init(options);
 }
 
-void Delaunay::init(bool quadtree)
+template <typename P>
+BasicDelaunay<P>::BasicDelaunay(std::vector<const Fragment*> fragments, const Options& options) :
+    mOptions(options)
 {
-    // Remove duplicates
-    std::sort(mPoints.begin(), mPoints.end(), Point::lexcomp2);
-    auto it = std::unique(mPoints.begin(), mPoints.end(),
-                          [](const Point& p, const Point& q){ return p.x == q.x && p.y == q.y; });
-    size_t newsize = it - mPoints.begin();
-    std::cerr << "Creating Delaunay... " << mPoints.size() << " -> " << newsize << " point(s)" << std::endl;
-    mPoints.resize(newsize);
+    Timer timer;
 
-    triangulate();
+    // Fragments without triangles are inserted afterwards.
+    auto split = std::partition(fragments.begin(), fragments.end(),
+                                [](const Fragment* f){ return f->points.size() >= 2; });
+    std::vector<P> remaining;
+    for (auto it = split ; it != fragments.end() ; ++it)
+        remaining.insert(remaining.end(), (*it)->points.begin(), (*it)->points.end());
+    fragments.erase(split, fragments.end());
 
-    if (quadtree)
+    // Each merge creates 2 triangles.
+    size_t triangleCount = 0;
+    for (const Fragment* f : fragments)
+        triangleCount += f->pool.size() + 2;
+
+    OTriangle hullleft, hullright;
+    if (!fragments.empty() && mPool.reserve(triangleCount) && stitch(fragments, 0, fragments.size(), hullleft, hullright))
+    {
+        std::cerr << "Stitching Delaunay... " << fragments.size() << " fragment(s) with " << mPoints.size() << " point(s)" << std::endl;
+        mTimings.stitch = timer.lap();
+
+        finalize();
+        mTimings.finalize = timer.lap();
+        reorder();
+        mTimings.reorder = timer.lap();
+
+        if (options.quadtree)
+            mQuadTree.setPoints(mPoints);
+        mTimings.quadtree = timer.lap();
+
+        if (!remaining.empty())
+            insert(std::move(remaining));
+        dropGhosts();
+        return;
+    }
+
+    // Overlapping fragments.
+    std::cerr << "Cannot stitch " << fragments.size() << " fragment(s)" << std::endl;
+    mPool.clear();
+    mPoints = std::move(remaining);
+    for (const Fragment* f : fragments)
+        mPoints.insert(mPoints.end(), f->points.begin(), f->points.end());
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(mPoints.size() >= 3);
+#endif
+    init(options);
+}
+
+template <typename P>
+BasicDelaunay<P>::BasicDelaunay(std::vector<P>&& points, TrianglePool&& pool, const Options& options) :
+    mPoints(std::move(points)),
+    mOptions(options),
+    mPool(std::move(pool))
+{
+    Timer timer;
+
+    finalize();
+    mTimings.finalize = timer.lap();
+    reorder();
+    mTimings.reorder = timer.lap();
+
+    if (options.quadtree)
         mQuadTree.setPoints(mPoints);
+    mTimings.quadtree = timer.lap();
+    dropGhosts();
 }
 
-std::unique_ptr<Point> Delaunay::findTrianglePoint(const Point& query) const
+template <typename P>
+typename BasicDelaunay<P>::Fragment BasicDelaunay<P>::makeFragment(std::vector<P>&& points)
 {
-    OTriangle otri = findTriangle(query);
-    int p1 = mPool.getOrg(otri);
-    int p2 = mPool.getDest(otri);
-    int p3 = mPool.getApex(otri);
+    Fragment fragment;
+    fragment.points = std::move(points);
+    removeDuplicates(fragment.points);
+
+    if (fragment.points.size() >= 2)
+    {
+        QuadTree quadTree;
+        sortForDivconq(fragment.points, quadTree);
+        fragment.pool.reserve(2 * fragment.points.size() - 2);
+        fragment.pool.divconq(fragment.points, 0, fragment.points.size(), true, fragment.farleft, fragment.farright);
+    }
+    return fragment;
+}
+
+template <typename P>
+void BasicDelaunay<P>::insert(std::vector<P>&& points)
+{
+    Timer timer;
 
-    if (p1 >= 0 && p2 >= 0 && p3 >= 0)
+    // Without any triangle (colinear points), start again from scratch.
+    if (mValidCount == 0)
     {
-        double z = Primitives::interpolate(query, mPoints[p1], mPoints[p2], mPoints[p3]);
-        return std::make_unique<Point>(query.x, query.y, z);
+        mPoints.insert(mPoints.end(), points.begin(), points.end());
+        init(mOptions);
+        return;
     }
 
-    return std::unique_ptr<Point>();
+    // Points outside of the hull are inserted into ghost triangles.
+    if (mPool.size() == mValidCount)
+    {
+        std::cerr << "Cannot insert into a triangulation without ghost triangles" << std::endl;
+        return;
+    }
+
+    removeDuplicates(points);
+    if (points.empty())
+        return;
+
+    // Each new vertex creates 2 triangles.
+    if (!mPool.reserve(mPool.size() + 2 * points.size()))
+        return;
+
+    std::vector<P> ordered = brioOrder(std::move(points));
+
+    OTriangle otri;
+    if (mQuadTree.size() > 0)
+        otri = OTriangle::decode(mPoint2triangle[mQuadTree.find(ordered.front())]);
+    else
+        otri = OTriangle(0, 0);
+
+    unsigned int oldsize = mPoints.size();
+    std::vector<int> touched;
+    insertPoints(ordered, 0, otri, &touched);
+    std::cerr << "Inserting in Delaunay... " << ordered.size() << " -> " << (mPoints.size() - oldsize) << " point(s)" << std::endl;
+
+    mTimings.insert = timer.lap();
+
+    finalizeTouched(touched);
+    // Points that were already vertices left room in the pool, worth a copy
+    // if large enough.
+    if (mPool.capacity() - mPool.size() > mPool.size() / INSERT_MAX_SLACK)
+        mPool.shrinkToFit();
+    mTimings.finalize = timer.lap();
+
+    // Like the quadtree, reorder once the inserted points are the majority.
+    mTimings.reorder = 0;
+    if (mPoints.size() >= 2 * mOrderedCount)
+    {
+        reorder();
+        mTimings.reorder = timer.lap();
+    }
+
+    // Queries still work with an outdated quadtree, only slower.
+    if (mOptions.quadtree && mPoints.size() >= 2 * static_cast<unsigned int>(mQuadTree.size()))
+    {
+        mQuadTree.setPoints(mPoints);
+        mTimings.quadtree = timer.lap();
+    }
 }
 
-OTriangle Delaunay::findTriangle(const Point& query) const
+template <typename P>
+void BasicDelaunay<P>::init(const Options& options)
 {
-    int start = mQuadTree.find(query);
-    OTriangle otri = OTriangle::decode(mPoint2triangle[start]);
+    Timer timer;
 
-    Point center = this->triangleCenter(otri);
+    size_t oldsize = mPoints.size();
+    removeDuplicates(mPoints);
+    std::cerr << "Creating Delaunay... " << oldsize << " -> " << mPoints.size() << " point(s)" << std::endl;
+    mTimings.dedup = timer.lap();
 
-    for (bool started = false; ; started = true)
+    if (options.backend == Options::INCREMENTAL && triangulateIncremental())
     {
-        if (!this->validTriangle(otri))
-            break;
+        timer.restart();
+        if (options.quadtree)
+            mQuadTree.setPoints(mPoints);
+        mTimings.quadtree = timer.lap();
+        dropGhosts();
+        return;
+    }
 
-        // Once started, do not go backwards!
-        if (!started)
-        {
-            if (this->intersectEdge(query, center, otri))
-            {
-                otri = mPool.sym(otri);
-                continue;
-            }
-        }
+    triangulate(options.parallel);
 
-        otri.next();
-        if (this->intersectEdge(query, center, otri))
-        {
-            otri = mPool.sym(otri);
-            continue;
-        }
+    // The quadtree was built to order the points.
+    if (!options.quadtree)
+        mQuadTree = QuadTree();
+    mTimings.quadtree = 0;
+    dropGhosts();
+}
 
-        otri.next();
-        if (this->intersectEdge(query, center, otri))
-        {
-            otri = mPool.sym(otri);
-            continue;
-        }
+template <typename P>
+std::unique_ptr<Point> BasicDelaunay<P>::findTrianglePoint(const Point& query) const
+{
+    OTriangle otri(0, 0);
+    if (mValidCount == 0 || !this->findTriangle(Mercator<P>::from(query), otri))
+        return std::unique_ptr<Point>();
+
+    return std::make_unique<Point>(query.x, query.y, this->interpolate(query, otri));
+}
 
-        break;
+template <typename P>
+unsigned int BasicDelaunay<P>::findTrianglePoints(const Point* queries, unsigned int count, double* heights) const
+{
+    if (mValidCount == 0)
+    {
+        std::fill(heights, heights + count, std::numeric_limits<double>::quiet_NaN());
+        return 0;
     }
 
-    return otri;
+    // Nearby queries walk through the same triangles.
+    double minx = std::numeric_limits<double>::infinity();
+    double miny = minx;
+    double maxx = -minx;
+    double maxy = -minx;
+    for (unsigned int i = 0 ; i < count ; ++i)
+    {
+        minx = std::min(minx, queries[i].x);
+        miny = std::min(miny, queries[i].y);
+        maxx = std::max(maxx, queries[i].x);
+        maxy = std::max(maxy, queries[i].y);
+    }
+    double extent = std::max(maxx - minx, maxy - miny);
+    double scale = extent > 0 ? ((1u << MORTON_BITS) - 1) / extent : 0;
+
+    std::vector<std::pair<uint32_t, int>> order(count);
+    for (unsigned int i = 0 ; i < count ; ++i)
+        order[i] = std::make_pair(mortonIndex(static_cast<uint32_t>((queries[i].x - minx) * scale),
+                                              static_cast<uint32_t>((queries[i].y - miny) * scale)), i);
+    radixSort(order);
+
+    std::atomic<unsigned int> found(0);
+    std::vector<std::function<void()>> jobs;
+    for (unsigned int begin = 0 ; begin < count ; begin += LOCATE_CHUNK)
+    {
+        unsigned int end = std::min(begin + LOCATE_CHUNK, count);
+        jobs.push_back([this, queries, heights, &order, &found, begin, end] {
+            unsigned int chunkFound = 0;
+            OTriangle otri = OTriangle(0, 0);
+            for (unsigned int i = begin ; i < end ; ++i)
+            {
+                const Point& query = queries[order[i].second];
+                double& height = heights[order[i].second];
+                if (this->findTriangle(Mercator<P>::from(query), otri))
+                {
+                    height = this->interpolate(query, otri);
+                    ++chunkFound;
+                }
+                else
+                    height = std::numeric_limits<double>::quiet_NaN();
+            }
+            found += chunkFound;
+        });
+    }
+
+    if (mOptions.parallel && jobs.size() > 1)
+        TaskManager::manager.parallel(jobs);
+    else
+        for (auto& job : jobs)
+            job();
+
+    return found;
 }
 
-bool Delaunay::validTriangle(const OTriangle& otri) const
+template <typename P>
+bool BasicDelaunay<P>::findTriangle(const P& query, OTriangle& otri) const
 {
-    int p1 = mPool.getOrg(otri);
-    int p2 = mPool.getDest(otri);
-    int p3 = mPool.getApex(otri);
-    return p1 >= 0 && p2 >= 0 && p3 >= 0;
+    // Without quadtree, start from the previous triangle.
+    if (mQuadTree.size() > 0)
+        otri = OTriangle::decode(mPoint2triangle[mQuadTree.find(query)]);
+
+    TrianglePool::Location location = mPool.locate(mPoints, query, otri);
+    if (location != TrianglePool::OUTSIDE)
+        return true;
+
+    // Without ghost triangles, the walk left the pool.
+    if (otri.tri < 0)
+        otri = OTriangle(0, 0);
+    return false;
 }
 
-Point Delaunay::triangleCenter(const OTriangle& otri) const
+template <typename P>
+double BasicDelaunay<P>::interpolate(const Point& query, const OTriangle& otri) const
 {
     int p1 = mPool.getOrg(otri);
     int p2 = mPool.getDest(otri);
     int p3 = mPool.getApex(otri);
-    return (mPoints[p1] + mPoints[p2] + mPoints[p3]) / 3.0;
+    return Primitives::interpolate(query, Mercator<P>::to(mPoints[p1]), Mercator<P>::to(mPoints[p2]), Mercator<P>::to(mPoints[p3]));
 }
 
-bool Delaunay::intersectEdge(const Point& query, const Point& cursor, const OTriangle& otri) const
+
+template <typename P>
+size_t BasicDelaunay<P>::triangleMemory() const
 {
-    int e1 = mPool.getOrg(otri);
-    int e2 = mPool.getDest(otri);
-    return Primitives::interSegments(query, cursor, mPoints[e1], mPoints[e2]);
+    return mPool.capacity() * sizeof(Triangle);
 }
 
-
-unsigned int Delaunay::iterPoints(const std::function<void(const Point&)>& f) const
+template <typename P>
+unsigned int BasicDelaunay<P>::iterPoints(const std::function<void(const Point&)>& f) const
 {
     for (auto&& p : mPoints)
-        f(p);
+        f(Mercator<P>::to(p));
     return mPoints.size();
 }
 
-void Delaunay::iterNormals(const std::vector<Point>& points, const std::function<void(const Point&)>& f) const
+template <typename P>
+void BasicDelaunay<P>::iterNormals(const std::vector<Point>& points, const std::function<void(const Point&)>& f) const
 {
     std::vector<Point> faceNormals;
     mPool.getFaceNormals(points, faceNormals);
 
-    for (auto i : mPoint2triangle)
+    // Sum of the normals of the valid triangles around each vertex, without
+    // walking around vertices on the hull (ghost triangles may be dropped).
+    std::vector<Point> normals(mPoints.size(), Point(0, 0, 0));
+    for (int t = 0 ; t < mValidCount ; ++t)
     {
-        OTriangle otri = OTriangle::decode(i);
-#ifdef ENABLE_GEOMETRIC_ASSERT
-        assert(mPool.getOrg(otri) >= 0);
-#endif
-
-        Point normal(0, 0, 0);
-        int normalCount = 0;
-
-        OTriangle iter = otri;
-        for (;;)
-        {
-            int dest = mPool.getDest(iter);
-            int apex = mPool.getApex(iter);
-            // Don't count points on the hull
-            if (dest >= 0 && apex >= 0)
-            {
-                normal += faceNormals[iter.tri];
-                ++normalCount;
-            }
-
-            iter = mPool.sym(iter);
-            iter.next();
-            if (iter == otri)
-                break;
-        }
+        OTriangle otri(t, 0);
+        for (int i = 0 ; i < 3 ; ++i, otri.next())
+            normals[mPool.getOrg(otri)] += faceNormals[t];
+    }
 
-#ifdef ENABLE_GEOMETRIC_ASSERT
-        assert(normalCount > 0);
-#endif
+    for (auto& normal : normals)
+    {
         normal.normalize3();
-
         f(normal);
     }
 }
 
-unsigned int Delaunay::iterTrianglesIndices(const std::function<void(unsigned int, unsigned int, unsigned int)>& f) const
+template <typename P>
+unsigned int BasicDelaunay<P>::iterTrianglesIndices(const std::function<void(unsigned int, unsigned int, unsigned int)>& f) const
 {
-    for (int i : mValidTriangles)
+    for (int t = 0 ; t < mValidCount ; ++t)
     {
-        OTriangle otri = OTriangle::decode(i);
+        OTriangle otri(t, 0);
         int e1 = mPool.getOrg(otri);
         int e2 = mPool.getDest(otri);
         int e3 = mPool.getApex(otri);
         f(e1, e2, e3);
     }
-    return mValidTriangles.size();
+    return mValidCount;
 }
 
 
-void Delaunay::triangulate()
+template <typename P>
+void BasicDelaunay<P>::triangulate(bool parallel)
 {
-    // Alternate order with subsets of <= 3 vertices always sorted by x
-    QuadTree quadTree;
-    quadTree.setPoints(mPoints, true);
+    Timer timer;
 
-    std::vector<Point> points;
-    for (int r : quadTree.rank())
-        points.push_back(mPoints[r]);
-    mPoints = std::move(points);
+    // Without any edge, there is nothing to triangulate nor to query.
+    if (mPoints.size() < 2)
+    {
+        mPool.clear();
+        mValidCount = 0;
+        mPoint2triangle.assign(mPoints.size(), -1);
+        return;
+    }
+
+    sortForDivconq(mPoints, mQuadTree);
+    mTimings.order = timer.lap();
 
+    // A triangulation of n points has 2n - 2 triangles, including ghosts.
     OTriangle hullleft, hullright;
     mPool.clear();
-    mPool.divconq(mPoints, 0, mPoints.size(), true, hullleft, hullright);
-
-    finalize(hullright);
+    if (!mPool.reserve(2 * mPoints.size() - 2))
+    {
+        mValidCount = 0;
+        mPoint2triangle.assign(mPoints.size(), -1);
+        return;
+    }
+    if (parallel && mPoints.size() >= DELAUNAY_PARALLEL_MIN_POINTS)
+    {
+        // Enough subsets to keep all threads busy.
+        int depth = 0;
+        while ((1u << depth) < TaskManager::manager.threadCount())
+            ++depth;
+        mPool.divconqParallel(mPoints, 0, mPoints.size(), true, hullleft, hullright, depth);
+    }
+    else
+        mPool.divconq(mPoints, 0, mPoints.size(), true, hullleft, hullright);
+    mTimings.divconq = timer.lap();
+
+    finalize();
+    mTimings.finalize = timer.lap();
+    reorder();
+    mTimings.reorder = timer.lap();
 }
 
-void Delaunay::finalize(const OTriangle& start)
+template <typename P>
+bool BasicDelaunay<P>::triangulateIncremental()
 {
-    mValidTriangles.clear();
-    mPoint2triangle.clear();
-    mPoint2triangle.resize(mPoints.size(), -1);
+    Timer timer;
+
+    if (mPoints.size() < 3)
+        return false;
+    std::vector<P> ordered = brioOrder(std::move(mPoints));
+
+    // Start from a triangle of the first non-colinear points, or let
+    // divconq() handle colinear sets.
+    auto third = std::find_if(ordered.begin() + 2, ordered.end(),
+                              [&ordered](const P& p){ return P::det(ordered[0], ordered[1], p) != 0; });
+    if (third == ordered.end())
+    {
+        mPoints = std::move(ordered);
+        return false;
+    }
+    std::iter_swap(ordered.begin() + 2, third);
+    mTimings.order = timer.lap();
+
+    // The quadtree of the previous points, if any, is outdated.
+    mQuadTree = QuadTree();
+
+    mPool.clear();
+    if (!mPool.reserve(2 * ordered.size() - 2))
+    {
+        mPoints = std::move(ordered);
+        return false;
+    }
+
+    OTriangle hullleft, hullright;
+    mPoints.assign(ordered.begin(), ordered.begin() + 3);
+    mPoints.reserve(ordered.size());
+    mPool.divconq(mPoints, 0, 3, true, hullleft, hullright);
+    insertPoints(ordered, 3, OTriangle(0, 0), nullptr);
+    mTimings.divconq = 0;
+    mTimings.insert = timer.lap();
+
+    finalize();
+    mTimings.finalize = timer.lap();
+    reorder();
+    mTimings.reorder = timer.lap();
+    return true;
+}
 
-    std::unordered_set<int> discovered;
-    std::vector<OTriangle> queue;
+template <typename P>
+std::vector<P> BasicDelaunay<P>::brioOrder(std::vector<P>&& points)
+{
+    // Biased randomized insertion order: rounds of doubling size drawn at
+    // random, to avoid cascades of flips on structured inputs (e.g. contour
+    // lines), each round in spatial order so that walks remain short.
+    std::shuffle(points.begin(), points.end(), std::mt19937(points.size()));
+    std::vector<P> ordered;
+    ordered.reserve(points.size());
+    for (size_t end = points.size(), begin = end / 2 ; end > 0 ; end = begin, begin /= 2)
+    {
+        if (end <= INSERT_FIRST_ROUND)
+            begin = 0;
+
+        std::vector<P> round(points.begin() + begin, points.begin() + end);
+        QuadTree order;
+        order.setPoints(round);
+        for (auto it = order.rank().rbegin() ; it != order.rank().rend() ; ++it)
+            ordered.push_back(round[*it]);
+    }
+    std::reverse(ordered.begin(), ordered.end());
+    return ordered;
+}
 
-    queue.push_back(start);
-    while (!queue.empty())
+template <typename P>
+void BasicDelaunay<P>::insertPoints(const std::vector<P>& ordered, size_t begin, OTriangle otri, std::vector<int>* touched)
+{
+    std::vector<int> vertexTouched;
+    for (size_t i = begin ; i < ordered.size() ; ++i)
     {
-        // Traverse triangle
-        OTriangle otri = queue.back();
-        queue.pop_back();
-        if (discovered.find(otri.tri) != discovered.end())
+        const P& p = ordered[i];
+        TrianglePool::Location location = mPool.locate(mPoints, p, otri);
+        if (location == TrianglePool::ON_VERTEX)
             continue;
-        discovered.insert(otri.tri);
 
-        // Add half-edges if not ghost
-        int p1 = mPool.getOrg(otri);
-        int p2 = mPool.getDest(otri);
-        int p3 = mPool.getApex(otri);
+        int vertex = mPoints.size();
+        mPoints.push_back(p);
+        vertexTouched.clear();
+        mPool.insertVertex(mPoints, vertex, otri, location, vertexTouched);
+        otri = OTriangle(vertexTouched.back(), 0);
+        if (touched)
+            touched->insert(touched->end(), vertexTouched.begin(), vertexTouched.end());
+    }
+}
+
+template <typename P>
+void BasicDelaunay<P>::removeDuplicates(std::vector<P>& points)
+{
+    std::sort(points.begin(), points.end(), P::lexcomp2);
+    auto it = std::unique(points.begin(), points.end(),
+                          [](const P& p, const P& q){ return p.x == q.x && p.y == q.y; });
+    points.resize(it - points.begin());
+}
+
+// Integer coordinates are sorted with a radix sort.
+template <>
+void BasicDelaunay<TilePoint>::removeDuplicates(std::vector<TilePoint>& points)
+{
+    radixSort(points, 64, [](const TilePoint& p) {
+        // Flip the sign bits to sort negative coordinates first.
+        uint64_t x = static_cast<uint32_t>(p.x) ^ 0x80000000u;
+        uint64_t y = static_cast<uint32_t>(p.y) ^ 0x80000000u;
+        return (x << 32) | y;
+    });
+    auto it = std::unique(points.begin(), points.end(),
+                          [](const TilePoint& p, const TilePoint& q){ return p.x == q.x && p.y == q.y; });
+    points.resize(it - points.begin());
+}
+
+template <typename P>
+void BasicDelaunay<P>::sortForDivconq(std::vector<P>& points, QuadTree& quadTree)
+{
+    quadTree.setPoints(points);
+
+    // Renumber the quadtree along with the points.
+    std::vector<P> sorted;
+    std::vector<int> newIndex(points.size());
+    sorted.reserve(points.size());
+    for (int r : quadTree.rank())
+    {
+        newIndex[r] = sorted.size();
+        sorted.push_back(points[r]);
+    }
+    points = std::move(sorted);
+    quadTree.renumber(newIndex);
+}
+
+template <typename P>
+bool BasicDelaunay<P>::stitch(std::vector<const Fragment*>& fragments, int begin, int end, OTriangle& farleft, OTriangle& farright)
+{
+    if (end == begin + 1)
+    {
+        const Fragment& fragment = *fragments[begin];
+        int offset = mPool.append(fragment.pool, mPoints.size());
+        mPoints.insert(mPoints.end(), fragment.points.begin(), fragment.points.end());
+        farleft = OTriangle(fragment.farleft.tri + offset, fragment.farleft.orient);
+        farright = OTriangle(fragment.farright.tri + offset, fragment.farright.orient);
+        return true;
+    }
+
+    // Find the most balanced line between fragments, vertical or horizontal.
+    size_t total = 0;
+    for (int i = begin ; i < end ; ++i)
+        total += fragments[i]->points.size();
+
+    auto sortByMin = [&fragments, begin, end](bool usex) {
+        std::sort(fragments.begin() + begin, fragments.begin() + end,
+                  [usex](const Fragment* f, const Fragment* g){ return usex ? f->minx < g->minx : f->miny < g->miny; });
+    };
+
+    int mid = -1;
+    bool usex = true;
+    size_t best = 0;
+    for (bool x : {true, false})
+    {
+        sortByMin(x);
 
-        if (p1 >= 0 && p2 >= 0 && p3 >= 0)
+        // A line before the i-th fragment is valid if no fragment before
+        // extends beyond it.
+        double maxbefore = -std::numeric_limits<double>::infinity();
+        size_t below = 0;
+        for (int i = begin + 1 ; i < end ; ++i)
         {
+            const Fragment* f = fragments[i-1];
+            maxbefore = std::max(maxbefore, x ? f->maxx : f->maxy);
+            below += f->points.size();
+            if (maxbefore > (x ? fragments[i]->minx : fragments[i]->miny))
+                continue;
+
+            size_t balance = 2 * below > total ? 2 * below - total : total - 2 * below;
+            if (mid < 0 || balance < best)
+            {
+                mid = i;
+                usex = x;
+                best = balance;
+            }
+        }
+    }
+    if (mid < 0)
+        return false;
+    if (usex)
+        sortByMin(true);
+
+    OTriangle innerleft, innerright;
+    if (!stitch(fragments, begin, mid, farleft, innerleft) || !stitch(fragments, mid, end, innerright, farright))
+        return false;
+    mPool.mergeHulls(mPoints, usex, farleft, innerleft, innerright, farright);
+    return true;
+}
+
+template <typename P>
+void BasicDelaunay<P>::finalize()
+{
+    // Valid triangles first, so that they don't need a separate index.
+    mValidCount = mPool.compact();
+
+    // Chunks of valid triangles, swept in parallel.
+    int chunkCount = (mValidCount + FINALIZE_CHUNK - 1) / FINALIZE_CHUNK;
+    std::vector<std::function<void()>> jobs;
+
+    // A vertex gets its valid triangle of highest index, as with a serial
+    // sweep, whatever the order of the chunks.
+    unsigned int pointCount = mPoints.size();
+    std::unique_ptr<std::atomic<int>[]> point2triangle(new std::atomic<int>[pointCount]);
+    for (unsigned int i = 0 ; i < pointCount ; ++i)
+        point2triangle[i].store(-1, std::memory_order_relaxed);
+
+    for (int c = 0 ; c < chunkCount ; ++c)
+    {
+        int begin = c * FINALIZE_CHUNK;
+        int end = std::min(begin + FINALIZE_CHUNK, mValidCount);
+        jobs.push_back([this, &point2triangle, begin, end] {
+            for (int t = begin ; t < end ; ++t)
+            {
+                OTriangle otri(t, 0);
 #ifdef ENABLE_GEOMETRIC_ASSERT
-            assert(Point::det(mPoints[p1], mPoints[p2], mPoints[p3]) > 0.0);
+                assert(P::det(mPoints[mPool.getOrg(otri)], mPoints[mPool.getDest(otri)], mPoints[mPool.getApex(otri)]) > 0.0);
 #endif
 
-            mValidTriangles.push_back(otri.encode());
+                for (int i = 0 ; i < 3 ; ++i, otri.next())
+                {
+                    std::atomic<int>& entry = point2triangle[mPool.getOrg(otri)];
+                    int value = otri.encode();
+                    int current = entry.load(std::memory_order_relaxed);
+                    while (current < value && !entry.compare_exchange_weak(current, value, std::memory_order_relaxed));
+                }
+            }
+        });
+    }
 
-            mPoint2triangle[p1] = otri.encode();
-            otri.next();
-            mPoint2triangle[p2] = otri.encode();
-            otri.next();
-            mPoint2triangle[p3] = otri.encode();
-            otri.next();
-        }
+    if (mOptions.parallel)
+        TaskManager::manager.parallel(jobs);
+    else
+        for (auto& job : jobs)
+            job();
+
+    mPoint2triangle.resize(pointCount);
+    for (unsigned int i = 0 ; i < pointCount ; ++i)
+        mPoint2triangle[i] = point2triangle[i].load(std::memory_order_relaxed);
+}
+
+template <typename P>
+void BasicDelaunay<P>::finalizeTouched(std::vector<int>& touched)
+{
+    radixSort(touched, 32, [](int t){ return static_cast<uint32_t>(t); });
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+    mValidCount = mPool.compact(mValidCount, touched);
 
-        // Add neighbors
-        queue.push_back(mPool.sym(otri));
-        otri.next();
-        queue.push_back(mPool.sym(otri));
-        otri.next();
-        queue.push_back(mPool.sym(otri));
+    // A vertex whose triangle was modified is a vertex of another valid
+    // touched triangle, and new vertices are only in touched triangles.
+    mPoint2triangle.resize(mPoints.size(), -1);
+    for (int t : touched)
+    {
+        OTriangle otri(t, 0);
+#ifdef ENABLE_GEOMETRIC_ASSERT
+        assert(P::det(mPoints[mPool.getOrg(otri)], mPoints[mPool.getDest(otri)], mPoints[mPool.getApex(otri)]) > 0.0);
+#endif
+        for (int i = 0 ; i < 3 ; ++i, otri.next())
+            mPoint2triangle[mPool.getOrg(otri)] = otri.encode();
+    }
+}
+
+template <typename P>
+void BasicDelaunay<P>::dropGhosts()
+{
+    if (mOptions.ghosts || mValidCount == 0)
+        return;
+
+    // Valid triangles come first.
+    mPool.truncate(mValidCount);
+}
+
+template <typename P>
+void BasicDelaunay<P>::reorder()
+{
+    if (!mOptions.reorder || mValidCount == 0)
+        return;
+
+    double minx = std::numeric_limits<double>::infinity();
+    double miny = minx;
+    double maxx = -minx;
+    double maxy = -minx;
+    for (const P& p : mPoints)
+    {
+        minx = std::min<double>(minx, p.x);
+        miny = std::min<double>(miny, p.y);
+        maxx = std::max<double>(maxx, p.x);
+        maxy = std::max<double>(maxy, p.y);
     }
+    double extent = std::max(maxx - minx, maxy - miny);
+    double scale = extent > 0 ? ((1u << MORTON_BITS) - 1) / extent : 0;
+    auto key = [&](const P& p) {
+        return mortonIndex(static_cast<uint32_t>((p.x - minx) * scale),
+                           static_cast<uint32_t>((p.y - miny) * scale));
+    };
+
+    // Points, by their own position on the curve.
+    unsigned int pointCount = mPoints.size();
+    std::vector<std::pair<uint32_t, int>> order(pointCount);
+    for (unsigned int i = 0 ; i < pointCount ; ++i)
+        order[i] = std::make_pair(key(mPoints[i]), i);
+    radixSort(order);
+
+    std::vector<int> newVertex(pointCount);
+    std::vector<P> points(pointCount);
+    for (unsigned int i = 0 ; i < pointCount ; ++i)
+    {
+        newVertex[order[i].second] = i;
+        points[i] = mPoints[order[i].second];
+    }
+    mPoints.swap(points);
+
+    // Valid triangles, around each vertex in the new order, so that
+    // consecutive triangles share vertices.  Ghost triangles stay at the end
+    // of the pool.
+    std::vector<int> newTriangle(mPool.size(), -1);
+    int triangleCount = 0;
+    for (unsigned int i = 0 ; i < pointCount ; ++i)
+    {
+        OTriangle otri = OTriangle::decode(mPoint2triangle[order[i].second]);
+        OTriangle iter = otri;
+        do
+        {
+            if (iter.tri < mValidCount && newTriangle[iter.tri] < 0)
+                newTriangle[iter.tri] = triangleCount++;
+            iter = mPool.sym(iter);
+            iter.next();
+        } while (iter != otri);
+    }
+    for (int t = mValidCount ; t < mPool.size() ; ++t)
+        newTriangle[t] = t;
+    mPool.renumber(newVertex, newTriangle);
+
+    std::vector<int> point2triangle(pointCount);
+    for (unsigned int i = 0 ; i < pointCount ; ++i)
+    {
+        OTriangle otri = OTriangle::decode(mPoint2triangle[i]);
+        point2triangle[newVertex[i]] = OTriangle(newTriangle[otri.tri], otri.orient).encode();
+    }
+    mPoint2triangle.swap(point2triangle);
+
+    if (mQuadTree.size() > 0)
+        mQuadTree.renumber(newVertex);
+    mOrderedCount = pointCount;
 }
+
+template class BasicDelaunay<Point>;
+template class BasicDelaunay<TilePoint>;
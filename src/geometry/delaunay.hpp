@@ -24,41 +24,147 @@
 #include <vector>
 #include <memory>
 
-class Delaunay
+// Delaunay triangulation of points of type P (Point or TilePoint).  Queries
+// and iterators use Mercator coordinates in both cases.
+template <typename P>
+class BasicDelaunay
 {
 public:
-    Delaunay(std::vector<Point>&& points, bool quadtree);
+    // Duration of each construction stage, in seconds.
+    struct Timings {
+        double dedup = 0;
+        // Build of the quadtree, shared by divconq and queries.
+        double order = 0;
+        double divconq = 0;
+        double finalize = 0;
+        // Rebuild of the quadtree after stitching or insertion.
+        double quadtree = 0;
+        double insert = 0;
+        double stitch = 0;
+        double reorder = 0;
+    };
+
+    struct Options {
+        enum Backend {
+            // Divide-and-conquer of Guibas and Stolfi.
+            DIVCONQ,
+            // Insertion of all points one by one, in biased randomized
+            // insertion order (BRIO).  Serial.
+            INCREMENTAL
+        };
+
+        // Algorithm of the initial triangulation.  Later insertions are
+        // always incremental.
+        Backend backend = DIVCONQ;
+        // Build a quadtree for point queries.
+        bool quadtree = true;
+        // Triangulate on all threads of the TaskManager (divconq backend).
+        bool parallel = true;
+        // Number points and triangles along a Morton curve, for locality of
+        // walks and of the mesh buffers.
+        bool reorder = true;
+        // Keep the ghost triangles outside of the hull, which insert() needs.
+        // Without them, queries still work on less memory.
+        bool ghosts = true;
+    };
+
+    // Triangulation of the points inside a rectangle, that can be cached and
+    // stitched with other fragments.
+    struct Fragment {
+        std::vector<P> points;
+        TrianglePool pool;
+        OTriangle farleft;
+        OTriangle farright;
+        // Half-open bounds of the points: [minx, maxx) x [miny, maxy).
+        double minx = 0;
+        double miny = 0;
+        double maxx = 0;
+        double maxy = 0;
+    };
+
+    BasicDelaunay(std::vector<P>&& points, const Options& options);
+    // Stitch fragments with disjoint bounds, instead of triangulating all
+    // their points again.
+    BasicDelaunay(std::vector<const Fragment*> fragments, const Options& options);
+    // Take a Delaunay triangulation of the points (without duplicates) made
+    // elsewhere, e.g. by the Simplifier.  The backend is not used.
+    BasicDelaunay(std::vector<P>&& points, TrianglePool&& pool, const Options& options);
+
+    // Remove duplicate points and triangulate them, without bounds.
+    static Fragment makeFragment(std::vector<P>&& points);
+
+    // Insert new points into the triangulation, with local edge flips.  The
+    // ghost triangles must have been kept.
+    void insert(std::vector<P>&& points);
 
     std::unique_ptr<Point> findTrianglePoint(const Point& point) const;
+    // Interpolate the height of 'count' points in parallel, or NaN for points
+    // outside of the triangulation, and return the number of points found.
+    unsigned int findTrianglePoints(const Point* queries, unsigned int count, double* heights) const;
 
-    inline const std::vector<Point>& points() const;
+    inline const std::vector<P>& points() const;
+    inline const Timings& timings() const;
+    // Bytes allocated for triangles.
+    size_t triangleMemory() const;
 
     unsigned int iterPoints(const std::function<void(const Point&)>& f) const;
     void iterNormals(const std::vector<Point>& points, const std::function<void(const Point&)>& f) const;
     unsigned int iterTrianglesIndices(const std::function<void(unsigned int, unsigned int, unsigned int)>& f) const;
 
 private:
-    void init(bool quadtree);
-    void triangulate();
-    void finalize(const OTriangle& start);
-
-    OTriangle findTriangle(const Point& point) const;
-
-    bool validTriangle(const OTriangle& otri) const;
-    Point triangleCenter(const OTriangle& otri) const;
-    bool intersectEdge(const Point& p1, const Point& p2, const OTriangle& otri) const;
-
-    std::vector<Point> mPoints;
+    void init(const Options& options);
+    void triangulate(bool parallel);
+    // Incremental backend, or false if all points are colinear.
+    bool triangulateIncremental();
+    void finalize();
+    // Same as finalize() after insertions, in time linear in the number of
+    // touched triangles.
+    void finalizeTouched(std::vector<int>& touched);
+    void reorder();
+    // Remove the ghost triangles, unless mOptions.ghosts.
+    void dropGhosts();
+    bool stitch(std::vector<const Fragment*>& fragments, int begin, int end, OTriangle& farleft, OTriangle& farright);
+
+    static void removeDuplicates(std::vector<P>& points);
+    static std::vector<P> brioOrder(std::vector<P>&& points);
+    // Insert ordered[begin:] one by one, walking from 'otri', except
+    // points that are already vertices.  Indices of modified triangles are
+    // appended to 'touched', if not null.
+    void insertPoints(const std::vector<P>& ordered, size_t begin, OTriangle otri, std::vector<int>* touched);
+    // Sort the points for divconq(), with the quadtree that splits them.
+    static void sortForDivconq(std::vector<P>& points, QuadTree& quadTree);
+
+    // Walk from 'otri' (or from the quadtree) to the triangle containing the
+    // point, unless it is outside of the triangulation.
+    bool findTriangle(const P& point, OTriangle& otri) const;
+    double interpolate(const Point& point, const OTriangle& otri) const;
+
+    std::vector<P> mPoints;
     std::vector<Point> mNormals;
     QuadTree mQuadTree;
+    Options mOptions;
 
     TrianglePool mPool;
-    std::vector<int> mValidTriangles;
+    // Valid triangles are the first ones of the pool.
+    int mValidCount = 0;
     std::vector<int> mPoint2triangle;
+    // Number of points when they were last reordered.
+    unsigned int mOrderedCount = 0;
+
+    Timings mTimings;
 };
 
-inline const std::vector<Point>& Delaunay::points() const
+template <typename P>
+inline const std::vector<P>& BasicDelaunay<P>::points() const
     {return mPoints;}
+template <typename P>
+inline const typename BasicDelaunay<P>::Timings& BasicDelaunay<P>::timings() const
+    {return mTimings;}
+
+// Triangulation of Mercator coordinates.
+typedef BasicDelaunay<Point> Delaunay;
+// Triangulation of integer coordinates, with exact predicates.
+typedef BasicDelaunay<TilePoint> TileDelaunay;
 
 #endif
 
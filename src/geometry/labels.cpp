@@ -20,56 +20,329 @@
 
 #include "protobuf/labels.pb.h"
 #include "geometry/astro.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
 
-void Labels::load(std::ifstream& ifs)
+// Zoom level of the tiles of the index of labels.
+static constexpr int INDEX_ZOOM = 30;
+// Zoom level of the tiles of the chunks of labels.
+static constexpr int CHUNK_ZOOM = 8;
+static constexpr int CHUNK_SHIFT = 2 * (INDEX_ZOOM - CHUNK_ZOOM);
+
+static constexpr char MAGIC[8] = {'P', 'X', 'L', 'A', 'B', 'E', 'L', 'S'};
+static constexpr uint32_t VERSION = 2;
+
+// Spread the lower 32 bits of v to even positions.
+static uint64_t spreadBits(uint64_t v)
+{
+    v &= 0xFFFFFFFF;
+    v = (v | (v << 16)) & 0x0000FFFF0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0F;
+    v = (v | (v << 2)) & 0x3333333333333333;
+    v = (v | (v << 1)) & 0x5555555555555555;
+    return v;
+}
+
+// Inverse of spreadBits().
+static uint32_t compactBits(uint64_t v)
+{
+    v &= 0x5555555555555555;
+    v = (v | (v >> 1)) & 0x3333333333333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF0000FFFF;
+    v = (v | (v >> 16)) & 0x00000000FFFFFFFF;
+    return v;
+}
+
+static uint64_t mortonIndex(uint32_t x, uint32_t y)
+{
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+bool Labels::open(const std::string& path)
+{
+    mChunks = nullptr;
+    mRecords = nullptr;
+    mNames = nullptr;
+    mChunkCount = 0;
+    mCount = 0;
+    if (!mFile.open(path))
+        return false;
+
+    Header header;
+    if (mFile.size() < sizeof(Header))
+    {
+        std::cerr << "Label file too short: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(&header, mFile.data(), sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION)
+    {
+        std::cerr << "Unknown format of label file: " << path << std::endl;
+        return false;
+    }
+
+    size_t chunksSize = sizeof(Chunk) * size_t(header.chunkCount);
+    size_t recordsSize = sizeof(Record) * size_t(header.count);
+    if (mFile.size() != sizeof(Header) + chunksSize + recordsSize + header.namesSize)
+    {
+        std::cerr << "Corrupted label file: " << path << std::endl;
+        return false;
+    }
+
+    // Chunks follow each other, and cover all records and names.  Records are
+    // checked only when their chunk is loaded.
+    const Chunk* chunks = reinterpret_cast<const Chunk*>(mFile.data() + sizeof(Header));
+    uint64_t first = 0;
+    uint64_t namesBegin = 0;
+    for (unsigned int i = 0 ; i < header.chunkCount ; ++i)
+    {
+        const Chunk& chunk = chunks[i];
+        if ((i && chunk.key <= chunks[i - 1].key) || chunk.first != first || chunk.namesBegin != namesBegin
+                || chunk.namesEnd <= chunk.namesBegin)
+        {
+            std::cerr << "Corrupted label file: " << path << std::endl;
+            return false;
+        }
+        first += chunk.count;
+        namesBegin = chunk.namesEnd;
+    }
+    if (first != header.count || namesBegin != header.namesSize)
+    {
+        std::cerr << "Corrupted label file: " << path << std::endl;
+        return false;
+    }
+
+    mChunks = chunks;
+    mRecords = reinterpret_cast<const Record*>(mFile.data() + sizeof(Header) + chunksSize);
+    mNames = mFile.data() + sizeof(Header) + chunksSize + recordsSize;
+    mChunkCount = header.chunkCount;
+    mCount = header.count;
+    mChunkStates.reset(new std::atomic<uint8_t>[mChunkCount]);
+    for (unsigned int i = 0 ; i < mChunkCount ; ++i)
+        mChunkStates[i] = CHUNK_UNKNOWN;
+
+    std::cerr << "Mapped " << mFile.size() << " bytes for " << mCount << " labels in " << mChunkCount << " chunks." << std::endl;
+    return true;
+}
+
+bool Labels::convert(std::istream& is, const std::string& path)
 {
     panoramix::Labels labels;
-    if (!labels.ParseFromIstream(&ifs))
+    if (!labels.ParseFromIstream(&is))
     {
         std::cerr << "Error parsing global label file" << std::endl;
-        return;
+        return false;
     }
 
-    for (auto& l : labels.labels())
+    // Records temporarily refer to their protobuf label instead of a name.
+    std::vector<Record> records;
+    records.reserve(labels.labels_size());
+    for (int i = 0 ; i < labels.labels_size() ; ++i)
     {
-        bool hasElevation = l.has_ele();
-        Point pt = Astro::mercatorFromLatLonDeg(l.lat(), l.lon(), hasElevation ? l.ele() : -1000);
+        const auto& l = labels.labels(i);
+        Record record;
+        std::memset(&record, 0, sizeof(Record));
+        record.key = Labels::key(Astro::mercatorFromLatLonDeg(l.lat(), l.lon()));
+        record.name = i;
+        record.hasElevation = l.has_ele();
+        record.elevation = l.ele();
 
-        Label::Type type;
         switch (l.type())
         {
         case panoramix::Labels::PEAK:
-            type = Label::PEAK;
+            record.type = PEAK;
             break;
         case panoramix::Labels::SADDLE:
-            type = Label::SADDLE;
+            record.type = SADDLE;
             break;
         case panoramix::Labels::VOLCANO:
-            type = Label::VOLCANO;
+            record.type = VOLCANO;
             break;
         default:
-            type = Label::OTHER;
+            record.type = OTHER;
         }
 
-        mLabels.emplace_back(std::string(l.name()), std::move(pt), type, hasElevation);
+        records.push_back(record);
     }
 
-    std::cerr << "Labels size: " << mLabels.size()*sizeof(Label) << "+ bytes for " << mLabels.size() << " labels." << std::endl;
+    // Sort the labels along the Morton curve, so that each chunk is a range
+    // of records, and store the names in the same order.
+    std::stable_sort(records.begin(), records.end(), [](const Record& lhs, const Record& rhs) {return lhs.key < rhs.key;});
+
+    std::vector<Chunk> chunks;
+    std::string names;
+    for (unsigned int i = 0 ; i < records.size() ; ++i)
+    {
+        Record& record = records[i];
+        uint64_t key = record.key >> CHUNK_SHIFT;
+        if (chunks.empty() || chunks.back().key != key)
+        {
+            if (!chunks.empty())
+                chunks.back().namesEnd = names.size();
+            Chunk chunk;
+            chunk.key = key;
+            chunk.first = i;
+            chunk.count = 0;
+            chunk.namesBegin = names.size();
+            chunk.namesEnd = names.size();
+            chunks.push_back(chunk);
+        }
+        ++chunks.back().count;
+
+        const std::string& name = labels.labels(record.name).name();
+        record.name = names.size();
+        names += name;
+        names.push_back('\0');
+        if (names.size() > UINT32_MAX)
+        {
+            std::cerr << "Too many names for label file: " << path << std::endl;
+            return false;
+        }
+    }
+    if (!chunks.empty())
+        chunks.back().namesEnd = names.size();
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.count = records.size();
+    header.chunkCount = chunks.size();
+    header.padding = 0;
+    header.namesSize = names.size();
+
+    // Write to a temporary file first, so that readers never see a partial
+    // file.
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream ofs(tmpPath, std::ofstream::binary | std::ofstream::trunc);
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        ofs.write(reinterpret_cast<const char*>(chunks.data()), sizeof(Chunk) * chunks.size());
+        ofs.write(reinterpret_cast<const char*>(records.data()), sizeof(Record) * records.size());
+        ofs.write(names.data(), names.size());
+        if (!ofs)
+        {
+            std::cerr << "Cannot write label file: " << tmpPath << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()))
+    {
+        std::cerr << "Cannot rename label file to " << path << std::endl;
+        return false;
+    }
+
+    std::cerr << "Converted " << records.size() << " labels in " << chunks.size() << " chunks to " << path << std::endl;
+    return true;
+}
+
+Point Labels::point(unsigned int i) const
+{
+    const Record& record = mRecords[i];
+    double zz = uint64_t(1) << INDEX_ZOOM;
+    double x = (compactBits(record.key) + 0.5) / zz;
+    double y = (compactBits(record.key >> 1) + 0.5) / zz;
+    return Point(x, y, record.hasElevation ? record.elevation : -1000);
+}
+
+void Labels::chunks(const TileInfo& tile, std::vector<unsigned int>& chunks) const
+{
+    uint64_t first;
+    uint64_t last;
+    if (!Labels::keyRange(tile, first, last))
+        return;
+
+    // Chunks whose tile contains the tile, or is inside it.
+    auto compare = [](const Chunk& chunk, uint64_t key) {return chunk.key < key;};
+    const Chunk* begin = std::lower_bound(mChunks, mChunks + mChunkCount, first >> CHUNK_SHIFT, compare);
+    const Chunk* end = std::lower_bound(begin, mChunks + mChunkCount, ((last - 1) >> CHUNK_SHIFT) + 1, compare);
+    for (const Chunk* it = begin ; it != end ; ++it)
+        chunks.push_back(it - mChunks);
+}
+
+bool Labels::loadChunk(unsigned int i) const
+{
+    uint8_t state = mChunkStates[i];
+    if (state != CHUNK_UNKNOWN)
+        return state == CHUNK_VALID;
+
+    // Concurrent loads of a chunk reach the same result.
+    const Chunk& chunk = mChunks[i];
+    size_t namesOffset = mNames - mFile.data();
+    mFile.prefetch(namesOffset + chunk.namesBegin, namesOffset + chunk.namesEnd);
+
+    bool valid = mNames[chunk.namesEnd - 1] == '\0';
+    for (unsigned int j = chunk.first ; valid && j < chunk.first + chunk.count ; ++j)
+    {
+        const Record& record = mRecords[j];
+        valid = (record.key >> CHUNK_SHIFT) == chunk.key
+                && (j == chunk.first || mRecords[j - 1].key <= record.key)
+                && record.name >= chunk.namesBegin && record.name < chunk.namesEnd;
+    }
+
+    if (!valid)
+        std::cerr << "Corrupted chunk of labels: " << i << std::endl;
+    mChunkStates[i] = valid ? CHUNK_VALID : CHUNK_INVALID;
+    return valid;
 }
 
-void Labels::filter(const TileInfo& tile, std::vector<Label>& labels)
+void Labels::filter(const TileInfo& tile, std::vector<unsigned int>& indices) const
 {
-    double zz = 1 << tile.zoom;
-    double xmin = tile.x / zz;
-    double xmax = (tile.x + 1) / zz;
-    double ymin = tile.y / zz;
-    double ymax = (tile.y + 1) / zz;
+    uint64_t first;
+    uint64_t last;
+    if (!Labels::keyRange(tile, first, last))
+        return;
 
-    for (auto& l : mLabels)
+    std::vector<unsigned int> chunks;
+    this->chunks(tile, chunks);
+
+    int zz = 1 << tile.zoom;
+    double xmin = tile.x / double(zz);
+    double xmax = (tile.x + 1) / double(zz);
+    double ymin = tile.y / double(zz);
+    double ymax = (tile.y + 1) / double(zz);
+    auto compare = [](const Record& record, uint64_t key) {return record.key < key;};
+    for (unsigned int c : chunks)
     {
-        double x = l.point.x;
-        double y = l.point.y;
-        if (x >= xmin && x < xmax && y >= ymin && y < ymax)
-            labels.push_back(l);
+        if (!this->loadChunk(c))
+            continue;
+
+        const Record* records = mRecords + mChunks[c].first;
+        const Record* begin = std::lower_bound(records, records + mChunks[c].count, first, compare);
+        const Record* end = std::lower_bound(begin, records + mChunks[c].count, last, compare);
+        for (const Record* it = begin ; it != end ; ++it)
+        {
+            unsigned int i = it - mRecords;
+            Point p = this->point(i);
+            if (p.x >= xmin && p.x < xmax && p.y >= ymin && p.y < ymax)
+                indices.push_back(i);
+        }
     }
 }
+
+uint64_t Labels::key(const Point& p)
+{
+    double zz = uint64_t(1) << INDEX_ZOOM;
+    double x = std::min(std::max(std::floor(p.x * zz), 0.0), zz - 1);
+    double y = std::min(std::max(std::floor(p.y * zz), 0.0), zz - 1);
+    return mortonIndex(x, y);
+}
+
+bool Labels::keyRange(const TileInfo& tile, uint64_t& first, uint64_t& last)
+{
+    int zz = 1 << tile.zoom;
+    if (tile.x < 0 || tile.x >= zz || tile.y < 0 || tile.y >= zz)
+        return false;
+
+    // Range of keys of the tile, or of its ancestor at INDEX_ZOOM.
+    int shift = std::max(INDEX_ZOOM - tile.zoom, 0);
+    int up = std::max(tile.zoom - INDEX_ZOOM, 0);
+    first = mortonIndex(tile.x >> up, tile.y >> up) << (2 * shift);
+    last = first + (uint64_t(1) << (2 * shift));
+    return true;
+}
@@ -19,8 +19,14 @@
 #ifndef LABELS_HPP
 #define LABELS_HPP
 
-#include <fstream>
-#include "protobuf/mvt.hpp"
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "geometry/point.hpp"
+#include "util/mappedfile.hpp"
 
 class TileInfo {
 public:
@@ -28,25 +34,104 @@ public:
     inline TileInfo(int _zoom, int _x, int _y) :
         x(_x), y(_y), zoom(_zoom) {}
 
+    inline bool operator==(const TileInfo& t) const
+        {return x == t.x && y == t.y && zoom == t.zoom;}
+
     int x;
     int y;
     int zoom;
 };
 
 
+// Labels of a compact file, mapped in memory and read in place: a header, a
+// directory of chunks, fixed-size records sorted along a Morton curve, and a
+// pool of names.  Each chunk holds the labels of one tile at CHUNK_ZOOM, with
+// their names, so that only the chunks of the viewed area are read from the
+// file.  The file is converted from the protobuf format of
+// src/protobuf/labels.proto.
 class Labels
 {
 public:
-    void load(std::ifstream& ifs);
+    enum Type : uint8_t {
+        PEAK, SADDLE, VOLCANO, OTHER
+    };
+
+    struct Record {
+        // Index of the tile of the label at INDEX_ZOOM along a Morton curve,
+        // so that the labels of a tile at any lower zoom are consecutive.
+        uint64_t key;
+        // Offset of the name (null-terminated UTF-8) in the pool of names.
+        uint32_t name;
+        // Meters, if hasElevation.
+        int32_t elevation;
+        Type type;
+        uint8_t hasElevation;
+        uint8_t padding[6];
+    };
+
+    // Map a compact file, and check its header and directory.
+    bool open(const std::string& path);
+    // Write the labels of a protobuf stream to a compact file.
+    static bool convert(std::istream& is, const std::string& path);
+
+    inline unsigned int count() const;
+    inline const Record& record(unsigned int i) const;
+    inline const char* name(unsigned int i) const;
+    // Position in Mercator coordinates, with the elevation if known.
+    Point point(unsigned int i) const;
+
+    // Append the indices of the chunks that intersect the tile.
+    void chunks(const TileInfo& tile, std::vector<unsigned int>& chunks) const;
+    // Check the records of a chunk, and read its names in the background.
+    // Chunks are checked once, and labels of invalid chunks are ignored.
+    bool loadChunk(unsigned int chunk) const;
 
-    inline int count() const;
-    void filter(const TileInfo& tile, std::vector<Label>& labels);
+    // Append the indices of the labels inside the tile, in time logarithmic
+    // in the number of labels (plus the size of the output).  The chunks of
+    // the tile are loaded if needed.
+    void filter(const TileInfo& tile, std::vector<unsigned int>& indices) const;
 
 private:
-    std::vector<Label> mLabels;
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+        uint32_t chunkCount;
+        uint32_t padding;
+        uint64_t namesSize;
+    };
+
+    struct Chunk {
+        // Index of the tile at CHUNK_ZOOM along the Morton curve.
+        uint64_t key;
+        // Range of records, and of the pool of names for these records.
+        uint32_t first;
+        uint32_t count;
+        uint32_t namesBegin;
+        uint32_t namesEnd;
+    };
+
+    enum ChunkState : uint8_t {
+        CHUNK_UNKNOWN, CHUNK_VALID, CHUNK_INVALID
+    };
+
+    static uint64_t key(const Point& p);
+    static bool keyRange(const TileInfo& tile, uint64_t& first, uint64_t& last);
+
+    MappedFile mFile;
+    const Chunk* mChunks = nullptr;
+    const Record* mRecords = nullptr;
+    const char* mNames = nullptr;
+    unsigned int mChunkCount = 0;
+    unsigned int mCount = 0;
+    mutable std::unique_ptr<std::atomic<uint8_t>[]> mChunkStates;
 };
 
-inline int Labels::count() const
-    {return mLabels.size();}
+inline unsigned int Labels::count() const
+    {return mCount;}
+inline const Labels::Record& Labels::record(unsigned int i) const
+    {return mRecords[i];}
+inline const char* Labels::name(unsigned int i) const
+    {return mNames + mRecords[i].name;}
 
 #endif
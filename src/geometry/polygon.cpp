@@ -18,6 +18,23 @@
 
 #include "polygon.hpp"
 
+#include <cmath>
+#include <utility>
+
+// Horizontal distance between p and the segment ab.
+static double distanceToSegment(const Point& a, const Point& b, const Point& p)
+{
+    Point ab = b - a;
+    Point ap = p - a;
+    double length2 = ab.dist2();
+    double t = length2 > 0 ? (ap.x * ab.x + ap.y * ab.y) / length2 : 0;
+    if (t <= 0)
+        return std::sqrt(ap.dist2());
+    if (t >= 1)
+        return std::sqrt((p - b).dist2());
+    return std::abs(ab.det(ap)) / std::sqrt(length2);
+}
+
 std::ostream& operator<<(std::ostream& out, const Polygon& p)
 {
     out << "[";
@@ -48,3 +65,48 @@ void Polygon::scaleY(double factor)
     for (auto& point : *this)
         point.scaleY(factor);
 }
+
+void Polygon::simplify(double tolerance)
+{
+    unsigned int n = this->size();
+    if (n < 2)
+        return;
+    bool closed = this->front().x == this->back().x && this->front().y == this->back().y;
+
+    std::vector<char> keep(n, false);
+    keep[0] = keep[n - 1] = true;
+    std::vector<std::pair<unsigned int, unsigned int>> ranges = {{0, n - 1}};
+    while (!ranges.empty())
+    {
+        unsigned int first = ranges.back().first;
+        unsigned int last = ranges.back().second;
+        ranges.pop_back();
+
+        double worst = tolerance;
+        unsigned int index = 0;
+        for (unsigned int i = first + 1 ; i < last ; ++i)
+        {
+            double d = distanceToSegment((*this)[first], (*this)[last], (*this)[i]);
+            if (d > worst)
+            {
+                worst = d;
+                index = i;
+            }
+        }
+
+        if (index)
+        {
+            keep[index] = true;
+            ranges.emplace_back(first, index);
+            ranges.emplace_back(index, last);
+        }
+    }
+
+    unsigned int count = 0;
+    for (unsigned int i = 0 ; i < n ; ++i)
+        if (keep[i])
+            (*this)[count++] = (*this)[i];
+    if (closed)
+        --count;
+    this->resize(count);
+}
@@ -33,6 +33,11 @@ public:
     void translate(const Point& p);
     void scaleXY(double factor);
     void scaleY(double factor);
+
+    // Douglas-Peucker simplification of the path, keeping the points farther
+    // than tolerance (horizontally) from the simplified path.  The closing
+    // point of a closed path is removed.
+    void simplify(double tolerance);
 };
 
 #endif
@@ -18,16 +18,20 @@
 
 #include "quadtree.hpp"
 
+#include "util/concurrency.hpp"
+
 #include <algorithm>
 #include <cassert>
+#include <numeric>
+
+// Below this number of points, subsets are built on the calling thread.
+static constexpr int PARALLEL_MIN_POINTS = 1 << 14;
 
-void QuadTree::setPoints(const std::vector<Point>& points, bool usex3)
+template <typename P>
+void QuadTree::setPoints(const std::vector<P>& points)
 {
     n = points.size();
     assert(n > 0);
-    std::vector<int> xindices;
-    std::vector<int> yindices;
-    std::vector<int> rank(n, 0);
 
     int log2n = 0;
     int powlog2n = 1;
@@ -37,45 +41,21 @@ void QuadTree::setPoints(const std::vector<Point>& points, bool usex3)
         ++log2n;
     }
 
-    // Sort points by x and by y.
-    xindices.reserve(n);
-    yindices.reserve(n);
-    for (int i = 0 ; i < n ; ++i)
-    {
-        xindices.push_back(i);
-        yindices.push_back(i);
-    }
-
-    if (usex3)
-    {
-        std::sort(xindices.begin(), xindices.end(),
-                  [&](int a, int b){return points[a].x == points[b].x ? points[a].y < points[b].y : points[a].x < points[b].x;});
-        std::sort(yindices.begin(), yindices.end(),
-                  [&](int a, int b){return points[a].y == points[b].y ? points[a].x < points[b].x : points[a].y < points[b].y;});
-    }
-    else
-    {
-        std::sort(xindices.begin(), xindices.end(),
-                  [&](int a, int b){return points[a].x < points[b].x;});
-        std::sort(yindices.begin(), yindices.end(),
-                  [&](int a, int b){return points[a].y < points[b].y;});
-    }
-
-    mSplit.resize(powlog2n);
-    build(points, xindices, yindices, rank, 0, n, log2n, 0, true, usex3);
-
-    mRankInternal.clear();
-    mRankInternal.resize(powlog2n, -1);
-    for (int i = 0 ; i < n ; ++i)
-        mRankInternal[rank[i]] = i;
-
-    mRank.clear();
-    for (int j : mRankInternal)
-        if (j >= 0)
-            mRank.push_back(j);
+    // Enough subsets to keep all threads busy.
+    int depth = 0;
+    while ((1u << depth) < TaskManager::manager.threadCount())
+        ++depth;
+
+    // Subsets are partitioned in place, so that leaves end up in rank order.
+    mRank.resize(n);
+    std::iota(mRank.begin(), mRank.end(), 0);
+    mSplit.assign(powlog2n, 0.0);
+    mRankInternal.assign(powlog2n, -1);
+    build(points, 0, n, log2n, 0, true, depth);
 }
 
-int QuadTree::find(const Point& p) const
+template <typename P>
+int QuadTree::find(const P& p) const
 {
     assert(n > 0);
     int begin = 0;
@@ -84,11 +64,11 @@ int QuadTree::find(const Point& p) const
     int r = 0;
     int powlog2n = 1;
 
-    for (bool side = false ; powlog2n < n ; powlog2n <<= 1, side = !side)
+    for (bool usex = true ; powlog2n < n ; powlog2n <<= 1, usex = !usex)
     {
         int diff = (end - begin) / 2;
 
-        double value = side ? p.y : p.x;
+        double value = usex || end - begin <= 3 ? p.x : p.y;
 
         if (diff && value < mSplit[i])
         {
@@ -109,44 +89,66 @@ int QuadTree::find(const Point& p) const
     return result;
 }
 
-void QuadTree::build(const std::vector<Point>& points, std::vector<int>& xindices, std::vector<int>& yindices, std::vector<int>& rank, int begin, int end, int log2n, int spliti, bool usex, bool usex3)
+void QuadTree::renumber(const std::vector<int>& newIndex)
 {
-    // If 'usex3', subsets of <= 3 vertices are sorted by x coordinate.
-    if (usex3 && end - begin <= 3 && !usex)
-    {
-        build(points, yindices, xindices, rank, begin, end, log2n, spliti, !usex, usex3);
-        return;
-    }
+    for (int& i : mRankInternal)
+        if (i >= 0)
+            i = newIndex[i];
+    for (int& i : mRank)
+        i = newIndex[i];
+}
 
-    int diff = (end - begin) / 2;
+template <typename P>
+void QuadTree::build(const std::vector<P>& points, int begin, int end, int log2n, int spliti, bool usex, int depth)
+{
+    // Leaves are numbered after the internal nodes, and hold 0 or 1 point.
     if (!log2n)
-        return;
-
-    // Update rank according to x coordinate
-    for (int i = begin ; i < begin+diff ; ++i)
     {
-        int& r = rank[xindices[i]];
-        r = 2*r;
-    }
-    for (int i = begin+diff ; i < end ; ++i)
-    {
-        int& r = rank[xindices[i]];
-        r = 2*r + 1;
+        mRankInternal[spliti - static_cast<int>(mSplit.size() - 1)] = begin < end ? mRank[begin] : -1;
+        return;
     }
 
+    // Subsets of <= 3 vertices are split by x coordinate.
+    if (end - begin <= 3)
+        usex = true;
+
+    // Linear-time selection of the median, with ties broken by the other
+    // coordinate.
+    int diff = (end - begin) / 2;
     if (diff)
     {
-        auto& p1 = points[xindices[begin+diff-1]];
-        auto& p2 = points[xindices[begin+diff]];
+        auto less = [&points, usex](int a, int b) {
+            const P& p = points[a];
+            const P& q = points[b];
+            return usex ? (p.x == q.x ? p.y < q.y : p.x < q.x)
+                        : (p.y == q.y ? p.x < q.x : p.y < q.y);
+        };
+        auto first = mRank.begin() + begin;
+        auto middle = first + diff;
+        std::nth_element(first, middle, mRank.begin() + end, less);
+
+        auto& p1 = points[*std::max_element(first, middle, less)];
+        auto& p2 = points[*middle];
         double split = (usex ? p1.x + p2.x : p1.y + p2.y) / 2.0;
         mSplit[spliti] = split;
     }
 
-    // Stable partition y coordinate according to rank
-    std::stable_partition(yindices.begin() + begin, yindices.begin() + end,
-                          [&](int a){return rank[a] % 2 == 0;});
-
     // Recurse, inverting both sides
-    build(points, yindices, xindices, rank, begin, begin+diff, log2n - 1, 2*spliti + 1, !usex, usex3);
-    build(points, yindices, xindices, rank, begin+diff, end, log2n - 1, 2*spliti + 2, !usex, usex3);
+    if (depth > 0 && end - begin >= PARALLEL_MIN_POINTS)
+    {
+        TaskManager::manager.parallel({
+            [&] {build(points, begin, begin+diff, log2n - 1, 2*spliti + 1, !usex, depth - 1);},
+            [&] {build(points, begin+diff, end, log2n - 1, 2*spliti + 2, !usex, depth - 1);}
+        });
+    }
+    else
+    {
+        build(points, begin, begin+diff, log2n - 1, 2*spliti + 1, !usex, 0);
+        build(points, begin+diff, end, log2n - 1, 2*spliti + 2, !usex, 0);
+    }
 }
+
+template void QuadTree::setPoints(const std::vector<Point>& points);
+template void QuadTree::setPoints(const std::vector<TilePoint>& points);
+template int QuadTree::find(const Point& p) const;
+template int QuadTree::find(const TilePoint& p) const;
@@ -21,22 +21,32 @@
 
 #include <vector>
 #include "point.hpp"
+#include "tilepoint.hpp"
 
 class QuadTree
 {
 public:
     QuadTree() = default;
 
-    // If 'usex3', subsets of <= 3 vertices are sorted by x coordinate.
-    void setPoints(const std::vector<Point>& points, bool usex3 = false);
-    int find(const Point& p) const;
+    // Points are split at the median alternately by x and y coordinates, and
+    // subsets of <= 3 vertices by x coordinate, so that rank() is the order
+    // expected by TrianglePool::divconq().  Instantiated for Point and
+    // TilePoint.
+    template <typename P>
+    void setPoints(const std::vector<P>& points);
+    template <typename P>
+    int find(const P& p) const;
+    // Rename point i as newIndex[i], after the points were reordered.
+    void renumber(const std::vector<int>& newIndex);
 
     inline const std::vector<int>& rank() const;
+    inline int size() const;
 
 private:
-    void build(const std::vector<Point>& points, std::vector<int>& xindices, std::vector<int>& yindices, std::vector<int>& rank, int begin, int end, int log2n, int spliti, bool usex, bool usex3);
+    template <typename P>
+    void build(const std::vector<P>& points, int begin, int end, int log2n, int spliti, bool usex, int depth);
 
-    int n;
+    int n = 0;
     std::vector<double> mSplit;
     std::vector<int> mRankInternal;
     std::vector<int> mRank;
@@ -44,6 +54,8 @@ private:
 
 inline const std::vector<int>& QuadTree::rank() const
     {return mRank;}
+inline int QuadTree::size() const
+    {return n;}
 
 #endif
 
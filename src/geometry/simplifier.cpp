@@ -0,0 +1,242 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#include "simplifier.hpp"
+
+#include "triangulate.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <queue>
+
+// Points whose tolerance is below this value (in meters) are kept unless
+// they lie exactly on the surface.
+static constexpr double MIN_TOLERANCE = 1e-9;
+
+// Vertical distance between p and the plane of the triangle abc.
+template <typename P>
+static double verticalError(const P& a, const P& b, const P& c, const P& p)
+{
+    double bx = static_cast<double>(b.x) - a.x;
+    double by = static_cast<double>(b.y) - a.y;
+    double cx = static_cast<double>(c.x) - a.x;
+    double cy = static_cast<double>(c.y) - a.y;
+    double px = static_cast<double>(p.x) - a.x;
+    double py = static_cast<double>(p.y) - a.y;
+    double d = bx * cy - by * cx;
+    if (d == 0.0)
+        return 0.0;
+
+    double u = (px * cy - py * cx) / d;
+    double v = (bx * py - by * px) / d;
+    double z = a.z + u * (static_cast<double>(b.z) - a.z) + v * (static_cast<double>(c.z) - a.z);
+    return std::abs(p.z - z);
+}
+
+
+template <typename P>
+std::vector<P> Simplifier::simplify(const std::vector<P>& points, const std::function<double(const P&)>& tolerance, TrianglePool* result)
+{
+    std::vector<int> hull = convexHull(points);
+    if (hull.size() < 3)
+    {
+        if (result)
+            result->clear();
+        return points;
+    }
+
+    int n = points.size();
+    std::vector<double> tol(n);
+    for (int i = 0 ; i < n ; ++i)
+        tol[i] = std::max(tolerance(points[i]), MIN_TOLERANCE);
+
+    // Triangulation of the hull.  Vertices are indices in 'points'.
+    TrianglePool pool;
+    std::vector<P> first = {points[hull[0]], points[hull[1]], points[hull[2]]};
+    OTriangle farleft, farright;
+    pool.divconq(first, 0, 3, true, farleft, farright);
+    std::vector<int> newTriangle(pool.size());
+    std::iota(newTriangle.begin(), newTriangle.end(), 0);
+    pool.renumber({hull[0], hull[1], hull[2]}, newTriangle);
+
+    std::vector<char> selected(n, false);
+    std::vector<int> touched;
+    OTriangle otri(0, 0);
+    for (unsigned int k = 0 ; k < hull.size() ; ++k)
+    {
+        selected[hull[k]] = true;
+        if (k < 3)
+            continue;
+
+        TrianglePool::Location location = pool.locate(points, points[hull[k]], otri);
+        touched.clear();
+        pool.insertVertex(points, hull[k], otri, location, touched);
+        otri = OTriangle(touched.back(), 0);
+    }
+
+    // Other points are listed in the triangle that contains them.
+    std::vector<int> head(pool.size(), -1);
+    std::vector<int> next(n, -1);
+    auto assign = [&](int i, OTriangle& otri) {
+        if (pool.locate(points, points[i], otri) == TrianglePool::ON_VERTEX)
+            return false;
+        // Points on the hull are in the real triangle of their edge.
+        if (pool.isGhost(otri))
+            otri = pool.sym(otri);
+        next[i] = head[otri.tri];
+        head[otri.tri] = i;
+        return true;
+    };
+    for (int i = 0 ; i < n ; ++i)
+        if (!selected[i])
+            assign(i, otri);
+
+    // Largest relative error of each triangle.  Entries of triangles modified
+    // since they were pushed are outdated.
+    struct Candidate {
+        double score;
+        int tri;
+        int version;
+        int point;
+
+        bool operator<(const Candidate& other) const
+            {return score < other.score;}
+    };
+    std::priority_queue<Candidate> queue;
+    std::vector<int> version(pool.size(), 0);
+    auto evaluate = [&](int t) {
+        OTriangle otri(t, 0);
+        const P& a = points[pool.getOrg(otri)];
+        const P& b = points[pool.getDest(otri)];
+        const P& c = points[pool.getApex(otri)];
+
+        Candidate candidate = {1.0, t, ++version[t], -1};
+        for (int i = head[t] ; i >= 0 ; i = next[i])
+        {
+            double score = verticalError(a, b, c, points[i]) / tol[i];
+            if (score > candidate.score)
+            {
+                candidate.score = score;
+                candidate.point = i;
+            }
+        }
+        if (candidate.point >= 0)
+            queue.push(candidate);
+    };
+    for (int t = 0 ; t < pool.size() ; ++t)
+        if (!pool.isGhost(OTriangle(t, 0)))
+            evaluate(t);
+
+    std::vector<int> mark(pool.size(), -1);
+    std::vector<std::pair<int, int>> moved;
+    std::vector<int> changed;
+    for (int stamp = 0 ; !queue.empty() ; ++stamp)
+    {
+        Candidate candidate = queue.top();
+        queue.pop();
+        if (candidate.version != version[candidate.tri])
+            continue;
+
+        int p = candidate.point;
+        OTriangle otri(candidate.tri, 0);
+        TrianglePool::Location location = pool.locate(points, points[p], otri);
+        touched.clear();
+        pool.insertVertex(points, p, otri, location, touched);
+        selected[p] = true;
+
+        head.resize(pool.size(), -1);
+        version.resize(pool.size(), 0);
+        mark.resize(pool.size(), -1);
+
+        // Points of modified triangles are assigned again, starting from
+        // their previous triangle.
+        moved.clear();
+        changed.clear();
+        for (int t : touched)
+        {
+            if (mark[t] == stamp)
+                continue;
+            mark[t] = stamp;
+            changed.push_back(t);
+            for (int i = head[t] ; i >= 0 ; i = next[i])
+                if (i != p)
+                    moved.emplace_back(i, t);
+            head[t] = -1;
+        }
+        for (auto& m : moved)
+        {
+            OTriangle otri(m.second, 0);
+            if (!assign(m.first, otri) || mark[otri.tri] == stamp)
+                continue;
+            // On an edge shared with an unmodified triangle.
+            mark[otri.tri] = stamp;
+            changed.push_back(otri.tri);
+        }
+        for (int t : changed)
+            evaluate(t);
+    }
+
+    std::vector<P> kept;
+    std::vector<int> newVertex(n, -1);
+    for (int i = 0 ; i < n ; ++i)
+    {
+        if (!selected[i])
+            continue;
+        newVertex[i] = kept.size();
+        kept.push_back(points[i]);
+    }
+    std::cerr << "Simplifying mesh... " << n << " -> " << kept.size() << " point(s)" << std::endl;
+
+    if (result)
+    {
+        std::vector<int> newTriangle(pool.size());
+        std::iota(newTriangle.begin(), newTriangle.end(), 0);
+        pool.renumber(newVertex, newTriangle);
+        *result = std::move(pool);
+    }
+    return kept;
+}
+
+template <typename P>
+std::vector<int> Simplifier::convexHull(const std::vector<P>& points)
+{
+    // Monotone chain, without colinear points.
+    std::vector<int> order(points.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&points](int a, int b){ return P::lexcomp2(points[a], points[b]); });
+
+    std::vector<int> hull;
+    for (int pass = 0 ; pass < 2 ; ++pass)
+    {
+        size_t start = hull.size();
+        for (int i : order)
+        {
+            while (hull.size() >= start + 2 && P::det(points[hull[hull.size() - 2]], points[hull.back()], points[i]) <= 0)
+                hull.pop_back();
+            hull.push_back(i);
+        }
+        // The last point of a chain starts the other one.
+        hull.pop_back();
+        std::reverse(order.begin(), order.end());
+    }
+    return hull;
+}
+
+template std::vector<Point> Simplifier::simplify(const std::vector<Point>& points, const std::function<double(const Point&)>& tolerance, TrianglePool* pool);
+template std::vector<TilePoint> Simplifier::simplify(const std::vector<TilePoint>& points, const std::function<double(const TilePoint&)>& tolerance, TrianglePool* pool);
@@ -0,0 +1,46 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#ifndef SIMPLIFIER_HPP
+#define SIMPLIFIER_HPP
+
+#include "triangulate.hpp"
+#include <functional>
+#include <vector>
+
+// Simplification of a terrain for rendering, by greedy insertion (Garland and
+// Heckbert): starting from the convex hull, the point of largest vertical
+// error relative to its tolerance is inserted into a Delaunay triangulation,
+// until all points are within their tolerance.
+class Simplifier
+{
+public:
+    // Subset of the points (without duplicates) whose triangulation has a
+    // vertical error below tolerance(p) at each point p.  If 'pool' is not
+    // null, it receives this Delaunay triangulation (ghost triangles
+    // included), over the indices of the result, or nothing if the points
+    // are colinear.  Instantiated for Point and TilePoint.
+    template <typename P>
+    static std::vector<P> simplify(const std::vector<P>& points, const std::function<double(const P&)>& tolerance, TrianglePool* pool = nullptr);
+
+private:
+    template <typename P>
+    static std::vector<int> convexHull(const std::vector<P>& points);
+};
+
+#endif
@@ -0,0 +1,280 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#include "streamingdelaunay.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// Initial size of the output files, doubled as needed.
+static constexpr size_t INITIAL_FILE_SIZE = 1 << 20;
+
+// Whether the circumcircle of the triangle abc lies strictly left of 'x'.  The
+// radius is enlarged to absorb rounding errors, which only delays retirement.
+template <typename P>
+static bool circleLeftOf(const P& a, const P& b, const P& c, double x)
+{
+    double bx = static_cast<double>(b.x) - a.x;
+    double by = static_cast<double>(b.y) - a.y;
+    double cx = static_cast<double>(c.x) - a.x;
+    double cy = static_cast<double>(c.y) - a.y;
+    double d = 2.0 * (bx * cy - by * cx);
+    if (d == 0.0)
+        return false;
+
+    double b2 = bx * bx + by * by;
+    double c2 = cx * cx + cy * cy;
+    double ux = (cy * b2 - by * c2) / d;
+    double uy = (bx * c2 - cx * b2) / d;
+    double r = std::sqrt(ux * ux + uy * uy);
+    return a.x + ux + r * (1.0 + 1e-6) < x;
+}
+
+
+template <typename P>
+StreamingDelaunay<P>::StreamingDelaunay(const std::string& path) :
+    mMaxx(-std::numeric_limits<double>::infinity()),
+    mNextx(-std::numeric_limits<double>::infinity())
+{
+    mPointFile.open(path + ".points", true);
+    mTriangleFile.open(path + ".triangles", true);
+}
+
+template <typename P>
+StreamingDelaunay<P>::~StreamingDelaunay()
+{
+    finish();
+}
+
+template <typename P>
+bool StreamingDelaunay<P>::addColumn(std::vector<P>&& points, double nextx)
+{
+    if (mFinished)
+    {
+        std::cerr << "Cannot add a column to a finished triangulation" << std::endl;
+        return false;
+    }
+    if (mFailed)
+    {
+        std::cerr << "Cannot add a column after a write error" << std::endl;
+        return false;
+    }
+    for (const P& p : points)
+    {
+        if (p.x <= mMaxx || p.x < mNextx)
+        {
+            std::cerr << "Column overlaps previous columns" << std::endl;
+            return false;
+        }
+    }
+    mNextx = nextx;
+
+    points.insert(points.end(), mPending.begin(), mPending.end());
+    mPending.clear();
+    typename BasicDelaunay<P>::Fragment fragment = BasicDelaunay<P>::makeFragment(std::move(points));
+    if (fragment.points.size() < 2)
+    {
+        mPending = std::move(fragment.points);
+        return true;
+    }
+
+    if (!append(mPointFile, mPointCount, fragment.points.data(), fragment.points.size()))
+        return false;
+    for (const P& p : fragment.points)
+    {
+        mIndices.push_back(mPointCount++);
+        mMaxx = std::max<double>(mMaxx, p.x);
+    }
+
+    if (!merge(std::move(fragment)))
+    {
+        mFailed = true;
+        return false;
+    }
+    retire(nextx);
+
+    // Written data is only read again by the consumer of the files.
+    mPointFile.release(mPointCount * sizeof(P));
+    mTriangleFile.release(mTriangleCount * 3 * sizeof(uint64_t));
+    return !mFailed;
+}
+
+template <typename P>
+bool StreamingDelaunay<P>::finish()
+{
+    if (mFinished)
+        return !mFailed;
+    mFinished = true;
+
+    // A last column of one point, right of all others.
+    for (const P& p : mPending)
+    {
+        if (mFailed || !append(mPointFile, mPointCount, &p, 1))
+            break;
+        int vertex = mPoints.size();
+        mPoints.push_back(p);
+        mIndices.push_back(mPointCount++);
+
+        if (mPool.size() == 0)
+            continue;
+        OTriangle otri = mFarright;
+        TrianglePool::Location location = mPool.locate(mPoints, p, otri);
+        std::vector<int> touched;
+        mPool.insertVertex(mPoints, vertex, otri, location, touched);
+    }
+    mPending.clear();
+
+    for (int t = 0 ; t < mPool.size() && !mFailed ; ++t)
+        if (!mPool.isGhost(OTriangle(t, 0)))
+            writeTriangle(OTriangle(t, 0));
+    if (mFailed)
+        std::cerr << "Streaming Delaunay failed, output is incomplete" << std::endl;
+    std::cerr << "Streaming Delaunay... " << mPointCount << " point(s), " << mTriangleCount << " triangle(s)" << std::endl;
+
+    mPoints = std::vector<P>();
+    mIndices = std::vector<uint64_t>();
+    mPool = TrianglePool();
+
+    mPointFile.resize(mPointCount * sizeof(P));
+    mTriangleFile.resize(mTriangleCount * 3 * sizeof(uint64_t));
+    mPointFile.close();
+    mTriangleFile.close();
+    return !mFailed;
+}
+
+template <typename P>
+bool StreamingDelaunay<P>::merge(typename BasicDelaunay<P>::Fragment&& fragment)
+{
+    int offset = mPoints.size();
+    mPoints.insert(mPoints.end(), fragment.points.begin(), fragment.points.end());
+
+    if (mPool.size() == 0)
+    {
+        mPool = std::move(fragment.pool);
+        mFarleft = fragment.farleft;
+        mFarright = fragment.farright;
+        return true;
+    }
+
+    // As in divconqParallel(), with the column as the right half.
+    if (!mPool.reserve(mPool.size() + fragment.pool.size() + 2))
+        return false;
+    int shift = mPool.append(fragment.pool, offset);
+    OTriangle innerleft = mFarright;
+    OTriangle innerright(fragment.farleft.tri + shift, fragment.farleft.orient);
+    OTriangle farright(fragment.farright.tri + shift, fragment.farright.orient);
+    mPool.mergeHulls(mPoints, true, mFarleft, innerleft, innerright, farright);
+    mFarright = farright;
+    return true;
+}
+
+template <typename P>
+void StreamingDelaunay<P>::retire(double nextx)
+{
+    // Triangles whose circumcircle is left of all later points are final.
+    // They are dropped once their neighbors are final too, so that merging
+    // later columns only reaches triangles still in memory.
+    int size = mPool.size();
+    std::vector<char> final(size, false);
+    for (int t = 0 ; t < size ; ++t)
+    {
+        OTriangle otri(t, 0);
+        if (!mPool.isGhost(otri))
+            final[t] = circleLeftOf(mPoints[mPool.getOrg(otri)], mPoints[mPool.getDest(otri)], mPoints[mPool.getApex(otri)], nextx);
+    }
+
+    std::vector<int> newTriangle(size, -1);
+    std::vector<int> newVertex(mPoints.size(), -1);
+    int count = 0;
+    for (int t = 0 ; t < size ; ++t)
+    {
+        // Links to dropped triangles are cleared.
+        bool drop = final[t];
+        for (int k = 0 ; drop && k < 3 ; ++k)
+        {
+            OTriangle neighbor = mPool.sym(OTriangle(t, k));
+            drop = neighbor.tri < 0 || final[neighbor.tri];
+        }
+
+        if (drop)
+        {
+            writeTriangle(OTriangle(t, 0));
+            continue;
+        }
+        newTriangle[t] = count++;
+        for (int v : mPool.triangles()[t].v)
+            if (v >= 0)
+                newVertex[v] = 0;
+    }
+
+    std::vector<P> points;
+    std::vector<uint64_t> indices;
+    for (unsigned int i = 0 ; i < mPoints.size() ; ++i)
+    {
+        if (newVertex[i] < 0)
+            continue;
+        newVertex[i] = points.size();
+        points.push_back(mPoints[i]);
+        indices.push_back(mIndices[i]);
+    }
+    mPoints.swap(points);
+    mIndices.swap(indices);
+
+    mPool.renumber(newVertex, newTriangle);
+    mFarleft.tri = newTriangle[mFarleft.tri];
+    mFarright.tri = newTriangle[mFarright.tri];
+}
+
+template <typename P>
+bool StreamingDelaunay<P>::writeTriangle(const OTriangle& otri)
+{
+    uint64_t indices[3] = {
+        mIndices[mPool.getOrg(otri)],
+        mIndices[mPool.getDest(otri)],
+        mIndices[mPool.getApex(otri)]
+    };
+    if (!append(mTriangleFile, 3 * mTriangleCount, indices, 3))
+        return false;
+    ++mTriangleCount;
+    return true;
+}
+
+template <typename P>
+template <typename T>
+bool StreamingDelaunay<P>::append(MappedFile& file, uint64_t count, const T* data, size_t n)
+{
+    // The mapping is lost when resizing fails, so nothing more is written.
+    if (mFailed)
+        return false;
+
+    size_t end = (count + n) * sizeof(T);
+    if (end > file.size() && !file.resize(std::max(end, std::max(2 * file.size(), INITIAL_FILE_SIZE))))
+    {
+        std::cerr << "Cannot grow the output of the streaming triangulation" << std::endl;
+        mFailed = true;
+        return false;
+    }
+    std::memcpy(file.data() + count * sizeof(T), data, n * sizeof(T));
+    return true;
+}
+
+template class StreamingDelaunay<Point>;
+template class StreamingDelaunay<TilePoint>;
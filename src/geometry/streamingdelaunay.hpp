@@ -0,0 +1,102 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#ifndef STREAMINGDELAUNAY_HPP
+#define STREAMINGDELAUNAY_HPP
+
+#include "delaunay.hpp"
+#include "util/mappedfile.hpp"
+#include <cstdint>
+#include <string>
+
+// Out-of-core Delaunay triangulation of a region swept from left to right, in
+// columns of points.  Triangles that later columns cannot change are written
+// to disk and dropped, so that memory is bounded by the size of a column and
+// of the hull, not of the region.
+//
+// Points are written to "<path>.points" (as P) and triangles to
+// "<path>.triangles" (as 3 indices of 64 bits), both memory-mapped.
+//
+// This is an offline tool: WorldModel triangulates the tiles in view in
+// memory.
+template <typename P>
+class StreamingDelaunay
+{
+public:
+    StreamingDelaunay(const std::string& path);
+    ~StreamingDelaunay();
+
+    // Add the points of a column, right of all previous columns.  Later
+    // columns must be right of 'nextx'.  Returns false on invalid columns, on
+    // write errors and on columns too large for a TrianglePool, after which
+    // the files are incomplete.
+    bool addColumn(std::vector<P>&& points, double nextx);
+    // Write all remaining triangles.  No column can be added afterwards.
+    // Returns false if any write failed.
+    bool finish();
+
+    inline uint64_t pointCount() const;
+    inline uint64_t triangleCount() const;
+    // Points and triangles still in memory.
+    inline unsigned int activePointCount() const;
+    inline int activeTriangleCount() const;
+
+private:
+    bool merge(typename BasicDelaunay<P>::Fragment&& fragment);
+    void retire(double nextx);
+    bool writeTriangle(const OTriangle& otri);
+
+    // Write n items at index 'count' of the file, growing it as needed.  On
+    // failure, mFailed is set.
+    template <typename T>
+    bool append(MappedFile& file, uint64_t count, const T* data, size_t n);
+
+    MappedFile mPointFile;
+    MappedFile mTriangleFile;
+    uint64_t mPointCount = 0;
+    uint64_t mTriangleCount = 0;
+
+    // Active part of the triangulation, and global index of its points.
+    std::vector<P> mPoints;
+    std::vector<uint64_t> mIndices;
+    TrianglePool mPool;
+    OTriangle mFarleft;
+    OTriangle mFarright;
+    // Points of columns too small to be triangulated, kept for the next one.
+    std::vector<P> mPending;
+    double mMaxx;
+    double mNextx;
+    bool mFinished = false;
+    // A write failed, and counts only cover the data written before.
+    bool mFailed = false;
+};
+
+template <typename P>
+inline uint64_t StreamingDelaunay<P>::pointCount() const
+    {return mPointCount;}
+template <typename P>
+inline uint64_t StreamingDelaunay<P>::triangleCount() const
+    {return mTriangleCount;}
+template <typename P>
+inline unsigned int StreamingDelaunay<P>::activePointCount() const
+    {return mPoints.size();}
+template <typename P>
+inline int StreamingDelaunay<P>::activeTriangleCount() const
+    {return mPool.size();}
+
+#endif
@@ -0,0 +1,55 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#include "tilepoint.hpp"
+
+constexpr double TilePoint::SCALE;
+
+std::ostream& operator<<(std::ostream& out, const TilePoint& p)
+{
+    return out << "[" << p.x << ", " << p.y << ", " << p.z << "]";
+}
+
+int64_t TilePoint::det(const TilePoint& p1, const TilePoint& p2, const TilePoint& p3)
+{
+    int64_t ax = int64_t(p2.x) - p1.x;
+    int64_t ay = int64_t(p2.y) - p1.y;
+    int64_t bx = int64_t(p3.x) - p1.x;
+    int64_t by = int64_t(p3.y) - p1.y;
+    return ax * by - ay * bx;
+}
+
+int TilePoint::incircle(const TilePoint& p1, const TilePoint& p2, const TilePoint& p3, const TilePoint& p4)
+{
+    int64_t ax = int64_t(p1.x) - p4.x;
+    int64_t ay = int64_t(p1.y) - p4.y;
+    int64_t bx = int64_t(p2.x) - p4.x;
+    int64_t by = int64_t(p2.y) - p4.y;
+    int64_t cx = int64_t(p3.x) - p4.x;
+    int64_t cy = int64_t(p3.y) - p4.y;
+
+    // Same determinant as Point::incircle().  Differences are below 2^28, so
+    // minors and squared norms are below 2^57, and the sum fits in 128 bits.
+    __int128 a2 = ax * ax + ay * ay;
+    __int128 b2 = bx * bx + by * by;
+    __int128 c2 = cx * cx + cy * cy;
+    __int128 result = a2 * (bx * cy - by * cx)
+                    + b2 * (cx * ay - cy * ax)
+                    + c2 * (ax * by - ay * bx);
+    return (result > 0) - (result < 0);
+}
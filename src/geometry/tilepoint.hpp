@@ -0,0 +1,101 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#ifndef TILEPOINT_HPP
+#define TILEPOINT_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include "config.hpp"
+#include "point.hpp"
+
+// Point of terrain in integer coordinates: global tile coordinates at
+// INTEGER_ZOOM, and elevation in meters.  It takes half the memory of a Point,
+// and geometric predicates are exact.
+class TilePoint
+{
+public:
+    friend std::ostream& operator<<(std::ostream& out, const TilePoint& p);
+
+    // Number of integer units per Mercator unit.
+    static constexpr double SCALE = 4096.0 * (1 << INTEGER_ZOOM);
+
+    TilePoint() = default;
+    inline TilePoint(int32_t _x, int32_t _y, int32_t _z = 0);
+
+    inline bool operator==(const TilePoint& p) const;
+    inline static bool lexcomp2(const TilePoint& p, const TilePoint& q);
+
+    // Conversion from and to Mercator coordinates (rounded to the closest
+    // integer coordinates).
+    inline static TilePoint fromMercator(const Point& p);
+    inline Point toMercator() const;
+    // Integer units per tile unit (1/4096 of a tile, as in vector tiles) at
+    // 'zoom', or 0 beyond INTEGER_ZOOM, where tile units are not integers.
+    inline static int tileScale(int zoom);
+
+    // Exact, without overflow for coordinates below 2^28.
+    static int64_t det(const TilePoint& p1, const TilePoint& p2, const TilePoint& p3);
+    // Only the sign is returned.
+    static int incircle(const TilePoint& p1, const TilePoint& p2, const TilePoint& p3, const TilePoint& p4);
+
+    int32_t x;
+    int32_t y;
+    int32_t z;
+};
+
+// Conversion to and from Mercator coordinates, for algorithms on both types
+// of points.
+template <typename P>
+struct Mercator;
+
+template <>
+struct Mercator<Point>
+{
+    static inline const Point& to(const Point& p)
+        {return p;}
+    static inline const Point& from(const Point& p)
+        {return p;}
+};
+
+template <>
+struct Mercator<TilePoint>
+{
+    static inline Point to(const TilePoint& p)
+        {return p.toMercator();}
+    static inline TilePoint from(const Point& p)
+        {return TilePoint::fromMercator(p);}
+};
+
+inline TilePoint::TilePoint(int32_t _x, int32_t _y, int32_t _z) :
+    x(_x), y(_y), z(_z) {}
+
+inline bool TilePoint::operator==(const TilePoint& p) const
+    {return x == p.x && y == p.y && z == p.z;}
+inline bool TilePoint::lexcomp2(const TilePoint& p, const TilePoint& q)
+    {return p.x == q.x ? p.y < q.y : p.x < q.x;}
+
+inline TilePoint TilePoint::fromMercator(const Point& p)
+    {return TilePoint(std::lround(p.x * SCALE), std::lround(p.y * SCALE), std::lround(p.z));}
+inline Point TilePoint::toMercator() const
+    {return Point(x / SCALE, y / SCALE, z);}
+inline int TilePoint::tileScale(int zoom)
+    {return zoom >= 0 && zoom <= INTEGER_ZOOM ? 1 << (INTEGER_ZOOM - zoom) : 0;}
+
+#endif
@@ -18,20 +18,34 @@
 
 #include "triangulate.hpp"
 
-inline static double counterClockwise(const std::vector<Point>& points, int a, int b, int c)
+#include "util/concurrency.hpp"
+
+#include <algorithm>
+#include <limits>
+
+// Below this number of points in a subset, divconqParallel() falls back to
+// divconq().
+static constexpr int PARALLEL_MIN_POINTS = 1 << 14;
+
+template <typename P>
+inline static double counterClockwise(const std::vector<P>& points, int a, int b, int c)
 {
-    return Point::det(points[a], points[b], points[c]);
+    return P::det(points[a], points[b], points[c]);
 }
 
-inline static double incircle(const std::vector<Point>& points, int a, int b, int c, int d)
+template <typename P>
+inline static double incircle(const std::vector<P>& points, int a, int b, int c, int d)
 {
-    return Point::incircle(points[a], points[b], points[c], points[d]);
+    return P::incircle(points[a], points[b], points[c], points[d]);
 }
 
 
 OTriangle TrianglePool::makeTriangle()
 {
     int tri = pool.size();
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(tri < MAX_TRIANGLES);
+#endif
     pool.emplace_back();
     return OTriangle(tri, 0);
 }
@@ -43,6 +57,164 @@ OTriangle TrianglePool::makeTriangle(int org, int dest, int apex)
     return otri;
 }
 
+int TrianglePool::compact()
+{
+    // Swap ghost triangles at the front with valid triangles at the back.
+    std::vector<std::pair<int, int>> swaps;
+    int i = 0;
+    int j = pool.size() - 1;
+    for (;;)
+    {
+        while (i < j && !isGhost(OTriangle(i, 0)))
+            ++i;
+        while (i < j && isGhost(OTriangle(j, 0)))
+            --j;
+        if (i >= j)
+            break;
+        swaps.emplace_back(i++, j--);
+    }
+    int validCount = (i == j && !isGhost(OTriangle(i, 0))) ? i + 1 : i;
+
+    swapTriangles(swaps);
+    return validCount;
+}
+
+int TrianglePool::compact(int validCount, std::vector<int>& touched)
+{
+    // Only touched triangles changed between valid and ghost.
+    int newValidCount = validCount;
+    for (int t : touched)
+    {
+        bool ghost = isGhost(OTriangle(t, 0));
+        if (t < validCount && ghost)
+            --newValidCount;
+        else if (t >= validCount && !ghost)
+            ++newValidCount;
+    }
+
+    // Ghost triangles before the new count and valid triangles after it are
+    // touched, or between the old and new counts.
+    int begin = std::min(validCount, newValidCount);
+    int end = std::max(validCount, newValidCount);
+    std::vector<int> ghosts;
+    std::vector<int> valids;
+    auto classify = [this, newValidCount, &ghosts, &valids](int t) {
+        bool ghost = isGhost(OTriangle(t, 0));
+        if (t < newValidCount && ghost)
+            ghosts.push_back(t);
+        else if (t >= newValidCount && !ghost)
+            valids.push_back(t);
+    };
+    for (int t : touched)
+        if (t < begin || t >= end)
+            classify(t);
+    for (int t = begin ; t < end ; ++t)
+        classify(t);
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(ghosts.size() == valids.size());
+#endif
+
+    std::vector<std::pair<int, int>> swaps;
+    for (unsigned int i = 0 ; i < ghosts.size() ; ++i)
+        swaps.emplace_back(ghosts[i], valids[i]);
+    swapTriangles(swaps);
+
+    // Touched triangles that stayed valid in place, and moved ones.
+    auto last = std::remove_if(touched.begin(), touched.end(),
+                               [this, newValidCount](int t){ return t >= newValidCount || isGhost(OTriangle(t, 0)); });
+    touched.erase(last, touched.end());
+    touched.insert(touched.end(), ghosts.begin(), ghosts.end());
+    return newValidCount;
+}
+
+void TrianglePool::swapTriangles(const std::vector<std::pair<int, int>>& swaps)
+{
+    // Old and new index of moved triangles, sorted by old index.
+    std::vector<std::pair<int, int>> moved;
+    moved.reserve(2 * swaps.size());
+    for (auto& s : swaps)
+    {
+        std::swap(pool[s.first], pool[s.second]);
+        moved.emplace_back(s.first, s.second);
+        moved.emplace_back(s.second, s.first);
+    }
+    std::sort(moved.begin(), moved.end());
+
+    // Redirect neighbors of moved triangles, then their back references.
+    for (auto& m : moved)
+    {
+        Triangle& tri = pool[m.second];
+        for (int k = 0 ; k < 3 ; ++k)
+        {
+            OTriangle otri = tri.getn(k);
+            auto found = std::lower_bound(moved.begin(), moved.end(), std::make_pair(otri.tri, std::numeric_limits<int>::min()));
+            if (found != moved.end() && found->first == otri.tri)
+                tri.setn(k, OTriangle(found->second, otri.orient));
+        }
+    }
+    for (auto& m : moved)
+    {
+        for (int k = 0 ; k < 3 ; ++k)
+        {
+            OTriangle otri = pool[m.second].getn(k);
+            pool[otri.tri].setn(otri.orient, OTriangle(m.second, k));
+        }
+    }
+}
+
+void TrianglePool::renumber(const std::vector<int>& newVertex, const std::vector<int>& newTriangle)
+{
+    int count = std::count_if(newTriangle.begin(), newTriangle.end(), [](int t){ return t >= 0; });
+    std::vector<Triangle> renumbered(count);
+    for (unsigned int t = 0 ; t < pool.size() ; ++t)
+    {
+        if (newTriangle[t] < 0)
+            continue;
+
+        Triangle& tri = renumbered[newTriangle[t]];
+        tri = pool[t];
+        for (int k = 0 ; k < 3 ; ++k)
+        {
+            if (tri.v[k] >= 0)
+                tri.v[k] = newVertex[tri.v[k]];
+            OTriangle otri = tri.getn(k);
+            if (otri.tri < 0)
+                continue;
+            if (newTriangle[otri.tri] >= 0)
+                tri.setn(k, OTriangle(newTriangle[otri.tri], otri.orient));
+            else
+                tri.clearn(k);
+        }
+    }
+    pool.swap(renumbered);
+}
+
+void TrianglePool::truncate(int count)
+{
+    pool.resize(count);
+    pool.shrink_to_fit();
+    for (auto& tri : pool)
+        for (int k = 0 ; k < 3 ; ++k)
+            if (tri.getn(k).tri >= count)
+                tri.clearn(k);
+}
+
+int TrianglePool::append(const TrianglePool& other, int vertexOffset)
+{
+    int offset = pool.size();
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(other.pool.size() <= MAX_TRIANGLES - pool.size());
+#endif
+    pool.insert(pool.end(), other.pool.begin(), other.pool.end());
+    for (auto it = pool.begin() + offset ; it != pool.end() ; ++it)
+    {
+        it->shiftn(offset);
+        if (vertexOffset)
+            it->shiftv(vertexOffset);
+    }
+    return offset;
+}
+
 void TrianglePool::edge(int begin, OTriangle& farleft, OTriangle& farright)
 {
     // Vertices
@@ -63,7 +235,8 @@ void TrianglePool::edge(int begin, OTriangle& farleft, OTriangle& farright)
     farleft.prev();
 }
 
-void TrianglePool::triangle(const std::vector<Point>& points, int begin, OTriangle& farleft, OTriangle& farright)
+template <typename P>
+void TrianglePool::triangle(const std::vector<P>& points, int begin, OTriangle& farleft, OTriangle& farright)
 {
     double area = counterClockwise(points, begin, begin+1, begin+2);
 
@@ -150,7 +323,8 @@ void TrianglePool::triangle(const std::vector<Point>& points, int begin, OTriang
 }
 
 // Walk counter-clockwise around the hull
-void TrianglePool::walkCounterClockwise(const std::vector<Point>& points, OTriangle& otri, const std::function<bool(const Point&, const Point&)>& pred) const
+template <typename P, typename Pred>
+void TrianglePool::walkCounterClockwise(const std::vector<P>& points, OTriangle& otri, Pred pred) const
 {
     int org = getOrg(otri);
     int apex = getApex(otri);
@@ -164,7 +338,8 @@ void TrianglePool::walkCounterClockwise(const std::vector<Point>& points, OTrian
 }
 
 // Walk clockwise around the hull
-void TrianglePool::walkClockwise(const std::vector<Point>& points, OTriangle& otri, const std::function<bool(const Point&, const Point&)>& pred) const
+template <typename P, typename Pred>
+void TrianglePool::walkClockwise(const std::vector<P>& points, OTriangle& otri, Pred pred) const
 {
     int dest = getDest(otri);
     int apex = getApex(otri);
@@ -177,36 +352,39 @@ void TrianglePool::walkClockwise(const std::vector<Point>& points, OTriangle& ot
     }
 }
 
-void TrianglePool::prepareHoriz(const std::vector<Point>& points, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright) const
+template <typename P>
+void TrianglePool::prepareHoriz(const std::vector<P>& points, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright) const
 {
     // Shift extremal vertices to topmost and bottommost, instead of leftmost and rightmost.
     walkCounterClockwise(points, farleft,
-                         [](const Point& apex, const Point& org){return apex.y < org.y;});
+                         [](const P& apex, const P& org){return apex.y < org.y;});
     farright = sym(farright);
     walkCounterClockwise(points, farright,
-                         [](const Point& apex, const Point& org){return apex.y > org.y;});
+                         [](const P& apex, const P& org){return apex.y > org.y;});
     farright = sym(farright);
 
     innerleft = sym(innerleft);
     walkCounterClockwise(points, innerleft,
-                         [](const Point& apex, const Point& org){return apex.y > org.y;});
+                         [](const P& apex, const P& org){return apex.y > org.y;});
     innerleft = sym(innerleft);
     walkCounterClockwise(points, innerright,
-                         [](const Point& apex, const Point& org){return apex.y < org.y;});
+                         [](const P& apex, const P& org){return apex.y < org.y;});
 }
 
-void TrianglePool::restoreHoriz(const std::vector<Point>& points, OTriangle& farleft, OTriangle& farright) const
+template <typename P>
+void TrianglePool::restoreHoriz(const std::vector<P>& points, OTriangle& farleft, OTriangle& farright) const
 {
     // Restore extremal vertices to leftmost and rightmost
     farleft = sym(farleft);
     walkClockwise(points, farleft,
-                  [](const Point& apex, const Point& dest){return apex.x < dest.x;});
+                  [](const P& apex, const P& dest){return apex.x < dest.x;});
     farleft = sym(farleft);
     walkClockwise(points, farright,
-                  [](const Point& apex, const Point& dest){return apex.x > dest.x;});
+                  [](const P& apex, const P& dest){return apex.x > dest.x;});
 }
 
-void TrianglePool::knitLeft(const std::vector<Point>& points, OTriangle& leftcand, int lowerleft, int lowerright, int& upperleft)
+template <typename P>
+void TrianglePool::knitLeft(const std::vector<P>& points, OTriangle& leftcand, int lowerleft, int lowerright, int& upperleft)
 {
     OTriangle nextedge = leftcand;
     nextedge.prev();
@@ -252,7 +430,8 @@ void TrianglePool::knitLeft(const std::vector<Point>& points, OTriangle& leftcan
     }
 }
 
-void TrianglePool::knitRight(const std::vector<Point>& points, OTriangle& rightcand, int lowerleft, int lowerright, int& upperright)
+template <typename P>
+void TrianglePool::knitRight(const std::vector<P>& points, OTriangle& rightcand, int lowerleft, int lowerright, int& upperright)
 {
     OTriangle nextedge = rightcand;
     nextedge.next();
@@ -298,7 +477,17 @@ void TrianglePool::knitRight(const std::vector<Point>& points, OTriangle& rightc
     }
 }
 
-void TrianglePool::mergeHulls(const std::vector<Point>& points, bool usex, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright)
+template <typename P>
+void TrianglePool::mergeHulls(const std::vector<P>& points, bool usex, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright)
+{
+    if (usex)
+        mergeHullsCut<true>(points, farleft, innerleft, innerright, farright);
+    else
+        mergeHullsCut<false>(points, farleft, innerleft, innerright, farright);
+}
+
+template <bool usex, typename P>
+void TrianglePool::mergeHullsCut(const std::vector<P>& points, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright)
 {
     // Horizontal cut.
     if (!usex)
@@ -422,11 +611,18 @@ void TrianglePool::mergeHulls(const std::vector<Point>& points, bool usex, OTria
 }
 
 // Triangulate a set of points by divide-and-conquer
-void TrianglePool::divconq(const std::vector<Point>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright)
+template <typename P>
+void TrianglePool::divconq(const std::vector<P>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright)
 {
-    if (end <= begin + 3)
-        usex = true;
+    if (usex)
+        divconqCut<true>(points, begin, end, farleft, farright);
+    else
+        divconqCut<false>(points, begin, end, farleft, farright);
+}
 
+template <bool usex, typename P>
+void TrianglePool::divconqCut(const std::vector<P>& points, int begin, int end, OTriangle& farleft, OTriangle& farright)
+{
     // 2 vertices = 1 edge
     if (end == begin + 2)
         edge(begin, farleft, farright);
@@ -438,9 +634,9 @@ void TrianglePool::divconq(const std::vector<Point>& points, int begin, int end,
     {
         OTriangle innerleft, innerright;
         int diff = (end - begin) / 2;
-        divconq(points, begin, begin+diff, !usex, farleft, innerleft);
-        divconq(points, begin+diff, end, !usex, innerright, farright);
-        mergeHulls(points, usex, farleft, innerleft, innerright, farright);
+        divconqCut<!usex>(points, begin, begin+diff, farleft, innerleft);
+        divconqCut<!usex>(points, begin+diff, end, innerright, farright);
+        mergeHullsCut<usex>(points, farleft, innerleft, innerright, farright);
     }
 
 #ifdef ENABLE_GEOMETRIC_ASSERT
@@ -449,6 +645,272 @@ void TrianglePool::divconq(const std::vector<Point>& points, int begin, int end,
 #endif
 }
 
+template <typename P>
+void TrianglePool::divconqParallel(const std::vector<P>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright, int depth)
+{
+    if (depth <= 0 || end - begin < PARALLEL_MIN_POINTS)
+    {
+        divconq(points, begin, end, usex, farleft, farright);
+        return;
+    }
+
+    // Each half is numbered from 0 in its own pool.  Appending both pools in
+    // order yields the same numbering as the serial recursion.
+    TrianglePool left, right;
+    OTriangle innerleft, innerright;
+    int diff = (end - begin) / 2;
+    left.reserve(2 * diff - 2);
+    right.reserve(2 * (end - begin - diff) - 2);
+    TaskManager::manager.parallel({
+        [&] {left.divconqParallel(points, begin, begin+diff, !usex, farleft, innerleft, depth - 1);},
+        [&] {right.divconqParallel(points, begin+diff, end, !usex, innerright, farright, depth - 1);}
+    });
+
+    // Merging the hulls creates 2 triangles.
+    reserve(pool.size() + left.size() + right.size() + 2);
+
+    int leftoffset = append(left);
+    farleft.tri += leftoffset;
+    innerleft.tri += leftoffset;
+    left = TrianglePool();
+
+    int rightoffset = append(right);
+    innerright.tri += rightoffset;
+    farright.tri += rightoffset;
+    right = TrianglePool();
+
+    mergeHulls(points, usex, farleft, innerleft, innerright, farright);
+
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(getDest(farleft) < 0);
+    assert(getOrg(farright) < 0);
+#endif
+}
+
+template <typename P>
+TrianglePool::Location TrianglePool::locate(const std::vector<P>& points, const P& p, OTriangle& otri) const
+{
+    // Start from a real triangle.
+    if (isGhost(otri))
+    {
+        while (getApex(otri) >= 0)
+            otri.next();
+        otri = sym(otri);
+    }
+
+    // Orientation of 'p' w.r.t. the edge org-dest.  Once started, the edge we
+    // came from is known to be positive.
+    double d0 = P::det(points[getOrg(otri)], points[getDest(otri)], p);
+    if (d0 < 0.0)
+    {
+        otri = sym(otri);
+        if (isGhost(otri))
+            return OUTSIDE;
+        d0 = -d0;
+    }
+
+    // Alternate the first edge tested to avoid cycles on degenerate inputs.
+    for (bool alternate = false ; ; alternate = !alternate)
+    {
+        int org = getOrg(otri);
+        int dest = getDest(otri);
+        int apex = getApex(otri);
+        double d1 = P::det(points[dest], points[apex], p);
+        double d2 = P::det(points[apex], points[org], p);
+
+        if (d1 < 0.0 && (alternate || d2 >= 0.0))
+        {
+            otri.next();
+            d0 = -d1;
+        }
+        else if (d2 < 0.0)
+        {
+            otri.prev();
+            d0 = -d2;
+        }
+        else
+        {
+            // Inside (or on the border of) the triangle.
+            for (int i = 0 ; i < 3 ; ++i, otri.next())
+            {
+                const P& q = points[getOrg(otri)];
+                if (q.x == p.x && q.y == p.y)
+                    return ON_VERTEX;
+            }
+            if (d0 == 0.0)
+                return ON_EDGE;
+            if (d1 == 0.0)
+            {
+                otri.next();
+                return ON_EDGE;
+            }
+            if (d2 == 0.0)
+            {
+                otri.prev();
+                return ON_EDGE;
+            }
+            return INSIDE;
+        }
+
+        otri = sym(otri);
+        if (isGhost(otri))
+            return OUTSIDE;
+    }
+}
+
+template <typename P>
+void TrianglePool::insertVertex(const std::vector<P>& points, int vertex, const OTriangle& otri, Location location, std::vector<int>& touched)
+{
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(location != ON_VERTEX);
+#endif
+
+    // Edges opposite to the new vertex, that may need a flip.
+    std::vector<OTriangle> stack;
+
+    OTriangle t0 = otri, t1, t2;
+    split(vertex, t0, t1, t2);
+    touched.push_back(t0.tri);
+    touched.push_back(t1.tri);
+    touched.push_back(t2.tri);
+    stack.push_back(t1);
+    stack.push_back(t2);
+
+    // A vertex on an edge creates a flat triangle on that edge, which is
+    // flipped away right now.
+    if (location == ON_EDGE)
+    {
+        OTriangle other;
+        flip(t0, other);
+        touched.push_back(other.tri);
+        stack.push_back(other);
+    }
+    stack.push_back(t0);
+
+    while (!stack.empty())
+    {
+        OTriangle edge = stack.back();
+        stack.pop_back();
+        if (!mustFlip(points, edge))
+            continue;
+
+        OTriangle other;
+        flip(edge, other);
+        touched.push_back(edge.tri);
+        touched.push_back(other.tri);
+        stack.push_back(edge);
+        stack.push_back(other);
+    }
+}
+
+// Split the triangle 't0' = (org, dest, apex) into (org, dest, vertex),
+// (dest, apex, vertex) and (apex, org, vertex), returned as edges opposite to
+// the vertex.
+void TrianglePool::split(int vertex, OTriangle& t0, OTriangle& t1, OTriangle& t2)
+{
+    int org = getOrg(t0);
+    int dest = getDest(t0);
+    int apex = getApex(t0);
+
+    OTriangle edge = t0;
+    edge.next();
+    OTriangle casing1 = sym(edge);
+    edge.next();
+    OTriangle casing2 = sym(edge);
+
+    // Vertices
+    setApex(t0, vertex);
+    t1 = makeTriangle(dest, apex, vertex);
+    t2 = makeTriangle(apex, org, vertex);
+
+    // Neighbors
+    bind(t1, casing1);
+    bind(t2, casing2);
+
+    t0.next();
+    t1.prev();
+    bind(t0, t1);
+    t1.next();
+    t1.next();
+    t2.prev();
+    bind(t1, t2);
+    t2.next();
+    t2.next();
+    t0.next();
+    bind(t2, t0);
+
+    t0.next();
+    t1.prev();
+    t2.prev();
+}
+
+// Flip the edge org-dest of 'otri' with the apex of the opposite triangle.
+// The two new triangles are returned as edges opposite to the former apex.
+void TrianglePool::flip(OTriangle& otri, OTriangle& other)
+{
+    OTriangle opposite = sym(otri);
+    int x = getOrg(otri);
+    int y = getDest(otri);
+    int p = getApex(otri);
+    int q = getApex(opposite);
+
+    OTriangle edge = otri;
+    edge.next();
+    OTriangle casingyp = sym(edge);
+    edge.next();
+    OTriangle casingpx = sym(edge);
+    edge = opposite;
+    edge.next();
+    OTriangle casingxq = sym(edge);
+    edge.next();
+    OTriangle casingqy = sym(edge);
+
+    // Vertices: (p, x, q) and (q, y, p).
+    OTriangle left = otri;
+    OTriangle right = opposite;
+    setVertices(left, p, x, q);
+    setVertices(right, q, y, p);
+
+    // Neighbors
+    bind(left, casingpx);
+    bind(right, casingqy);
+    left.next();
+    bind(left, casingxq);
+    right.next();
+    bind(right, casingyp);
+    left.next();
+    right.next();
+    bind(left, right);
+
+    otri = left;
+    otri.prev();
+    other = right;
+    other.next();
+}
+
+template <typename P>
+bool TrianglePool::mustFlip(const std::vector<P>& points, const OTriangle& otri) const
+{
+    int x = getOrg(otri);
+    int y = getDest(otri);
+    int p = getApex(otri);
+    int q = getApex(sym(otri));
+
+    if (x >= 0 && y >= 0)
+    {
+        // Hull edge.
+        if (q < 0)
+            return false;
+        return incircle(points, x, y, p, q) > 0.0;
+    }
+
+    // Edge from the hull to the ghost vertex: flip if the new vertex sees the
+    // hull edge on the other side, i.e. the new real triangle is valid.
+    if (x < 0)
+        return counterClockwise(points, q, y, p) > 0.0;
+    return counterClockwise(points, x, q, p) > 0.0;
+}
+
 void TrianglePool::getFaceNormals(const std::vector<Point>& points, std::vector<Point>& normals) const
 {
     normals.clear();
@@ -472,3 +934,14 @@ void TrianglePool::getFaceNormals(const std::vector<Point>& points, std::vector<
         normals.emplace_back(normal);
     }
 }
+
+template void TrianglePool::divconq(const std::vector<Point>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright);
+template void TrianglePool::divconq(const std::vector<TilePoint>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright);
+template void TrianglePool::divconqParallel(const std::vector<Point>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright, int depth);
+template void TrianglePool::divconqParallel(const std::vector<TilePoint>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright, int depth);
+template void TrianglePool::mergeHulls(const std::vector<Point>& points, bool usex, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright);
+template void TrianglePool::mergeHulls(const std::vector<TilePoint>& points, bool usex, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright);
+template TrianglePool::Location TrianglePool::locate(const std::vector<Point>& points, const Point& p, OTriangle& otri) const;
+template TrianglePool::Location TrianglePool::locate(const std::vector<TilePoint>& points, const TilePoint& p, OTriangle& otri) const;
+template void TrianglePool::insertVertex(const std::vector<Point>& points, int vertex, const OTriangle& otri, Location location, std::vector<int>& touched);
+template void TrianglePool::insertVertex(const std::vector<TilePoint>& points, int vertex, const OTriangle& otri, Location location, std::vector<int>& touched);
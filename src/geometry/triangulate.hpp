@@ -21,7 +21,10 @@
 
 #include <vector>
 #include <functional>
+#include <iostream>
+#include <limits>
 #include "point.hpp"
+#include "tilepoint.hpp"
 #include "config.hpp"
 
 #ifdef ENABLE_GEOMETRIC_ASSERT
@@ -41,9 +44,15 @@ public:
         {return tri != otri.tri || orient != otri.orient;}
 
     inline void next()
-        {orient = (orient+1) % 3;}
+        {orient = plus1(orient);}
     inline void prev()
-        {orient = (orient+2) % 3;}
+        {orient = minus1(orient);}
+
+    // Rotations modulo 3, without divisions.
+    inline static int plus1(int i)
+        {return i == 2 ? 0 : i + 1;}
+    inline static int minus1(int i)
+        {return i == 0 ? 2 : i - 1;}
 
     inline int encode() const
         {return (tri << 2) | orient;}
@@ -64,6 +73,18 @@ public:
         {n[i] = -1;}
     inline OTriangle getn(int i) const
         {return OTriangle::decode(n[i]);}
+    // Shift neighbors by 'offset' triangles.
+    inline void shiftn(int offset) {
+        for (int i = 0 ; i < 3 ; ++i)
+            if (n[i] >= 0)
+                n[i] += offset << 2;
+    }
+    // Shift vertices by 'offset', except the ghost vertex.
+    inline void shiftv(int offset) {
+        for (int i = 0 ; i < 3 ; ++i)
+            if (v[i] >= 0)
+                v[i] += offset;
+    }
 
 private:
     // Neighbors
@@ -77,43 +98,121 @@ public:
 
 class TrianglePool {
 public:
+    enum Location {INSIDE, ON_EDGE, ON_VERTEX, OUTSIDE};
+
+    // Links are encoded as (tri << 2) | orient in an int.
+    static constexpr int MAX_TRIANGLES = std::numeric_limits<int>::max() >> 2;
+
     TrianglePool() = default;
 
     inline void clear();
+    // Returns false if 'count' exceeds MAX_TRIANGLES.
+    inline bool reserve(size_t count);
+    inline void shrinkToFit();
+    inline int size() const;
+    inline int capacity() const;
+
+    inline const std::vector<Triangle>& triangles() const;
+    inline void setTriangles(std::vector<Triangle>&& triangles);
 
     inline int getOrg(const OTriangle& otri) const;
     inline int getDest(const OTriangle& otri) const;
     inline int getApex(const OTriangle& otri) const;
 
     inline OTriangle sym(const OTriangle& otri) const;
+    inline bool isGhost(const OTriangle& otri) const;
+
+    // Algorithms on points are instantiated for Point and TilePoint.
 
     // Triangulate a set of points by divide-and-conquer
-    void divconq(const std::vector<Point>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright);
+    template <typename P>
+    void divconq(const std::vector<P>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright);
+    // Same result as divconq(), but the top 'depth' levels of recursion
+    // triangulate both halves in parallel, each in its own sub-pool.
+    template <typename P>
+    void divconqParallel(const std::vector<P>& points, int begin, int end, bool usex, OTriangle& farleft, OTriangle& farright, int depth);
+
+    // Move ghost triangles after all valid triangles, and return the number
+    // of valid triangles.  Oriented triangles held outside are invalidated.
+    int compact();
+    // Same as compact() after insertions into a compact pool of 'validCount'
+    // valid triangles, in time linear in the number of 'touched' triangles
+    // (modified or new, sorted and unique).  On return, 'touched' holds the
+    // valid triangles that were touched or moved.
+    int compact(int validCount, std::vector<int>& touched);
+    // Move triangle t to newTriangle[t], and rename vertex v as newVertex[v].
+    // Triangles with newTriangle[t] < 0 are removed, and links to them are
+    // cleared.
+    void renumber(const std::vector<int>& newVertex, const std::vector<int>& newTriangle);
+    // Remove the triangles from 'count' on, and clear links to them.
+    void truncate(int count);
+
+    // Append the triangles of another pool, with vertices shifted by
+    // 'vertexOffset', and return the index shift of the triangles.
+    int append(const TrianglePool& other, int vertexOffset = 0);
+    // Merge two triangulations separated by a vertical line (usex) or by a
+    // horizontal line, the "left" one being below.
+    template <typename P>
+    void mergeHulls(const std::vector<P>& points, bool usex, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright);
 
     void getFaceNormals(const std::vector<Point>& points, std::vector<Point>& normals) const;
 
+    // Walk from 'otri' to the point 'p' with orientation tests.  On return,
+    // 'otri' is the triangle containing 'p' (INSIDE), or has 'p' on its edge
+    // org-dest (ON_EDGE), or has 'p' as org (ON_VERTEX), or is a ghost
+    // triangle whose hull edge org-dest is visible from 'p' (OUTSIDE).  In a
+    // truncated pool, 'otri' is a cleared link instead.
+    template <typename P>
+    Location locate(const std::vector<P>& points, const P& p, OTriangle& otri) const;
+    // Insert a vertex at a location given by locate(), and restore the
+    // Delaunay property with edge flips (Lawson).  Indices of modified
+    // triangles are appended to 'touched'.
+    template <typename P>
+    void insertVertex(const std::vector<P>& points, int vertex, const OTriangle& otri, Location location, std::vector<int>& touched);
+
 private:
     OTriangle makeTriangle();
     OTriangle makeTriangle(int org, int dest, int apex = -1);
 
     void edge(int begin, OTriangle& farleft, OTriangle& farright);
-    void triangle(const std::vector<Point>& points, int begin, OTriangle& farleft, OTriangle& farright);
-
-    void walkCounterClockwise(const std::vector<Point>& points, OTriangle& otri, const std::function<bool(const Point&, const Point&)>& pred) const;
-    void walkClockwise(const std::vector<Point>& points, OTriangle& otri, const std::function<bool(const Point&, const Point&)>& pred) const;
-
-    void prepareHoriz(const std::vector<Point>& points, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright) const;
-    void restoreHoriz(const std::vector<Point>& points, OTriangle& farleft, OTriangle& farright) const;
-
-    void knitLeft(const std::vector<Point>& points, OTriangle& leftcand, int lowerleft, int lowerright, int& upperleft);
-    void knitRight(const std::vector<Point>& points, OTriangle& rightcand, int lowerleft, int lowerright, int& upperright);
-    void mergeHulls(const std::vector<Point>& points, bool usex, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright);
+    template <typename P>
+    void triangle(const std::vector<P>& points, int begin, OTriangle& farleft, OTriangle& farright);
+
+    // The cut direction and predicates are template parameters, so that the
+    // core of divide-and-conquer is specialized at compile time.
+    template <bool usex, typename P>
+    void divconqCut(const std::vector<P>& points, int begin, int end, OTriangle& farleft, OTriangle& farright);
+    template <bool usex, typename P>
+    void mergeHullsCut(const std::vector<P>& points, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright);
+
+    template <typename P, typename Pred>
+    void walkCounterClockwise(const std::vector<P>& points, OTriangle& otri, Pred pred) const;
+    template <typename P, typename Pred>
+    void walkClockwise(const std::vector<P>& points, OTriangle& otri, Pred pred) const;
+
+    template <typename P>
+    void prepareHoriz(const std::vector<P>& points, OTriangle& farleft, OTriangle& innerleft, OTriangle& innerright, OTriangle& farright) const;
+    template <typename P>
+    void restoreHoriz(const std::vector<P>& points, OTriangle& farleft, OTriangle& farright) const;
+
+    template <typename P>
+    void knitLeft(const std::vector<P>& points, OTriangle& leftcand, int lowerleft, int lowerright, int& upperleft);
+    template <typename P>
+    void knitRight(const std::vector<P>& points, OTriangle& rightcand, int lowerleft, int lowerright, int& upperright);
+
+    // Swap pairs of triangles, and redirect links to them.
+    void swapTriangles(const std::vector<std::pair<int, int>>& swaps);
+
+    void split(int vertex, OTriangle& t0, OTriangle& t1, OTriangle& t2);
+    void flip(OTriangle& otri, OTriangle& other);
+    template <typename P>
+    bool mustFlip(const std::vector<P>& points, const OTriangle& otri) const;
 
     inline void setVertices(OTriangle& otri, int org, int dest, int apex) {
         Triangle& tri = pool[otri.tri];
         tri.v[ otri.orient       ] = apex;
-        tri.v[(otri.orient+1) % 3] = org;
-        tri.v[(otri.orient+2) % 3] = dest;
+        tri.v[OTriangle::plus1(otri.orient)] = org;
+        tri.v[OTriangle::minus1(otri.orient)] = dest;
     }
 
     inline void setApex(OTriangle& otri, int vertex) {
@@ -122,11 +221,11 @@ private:
     }
     inline void setOrg(OTriangle& otri, int vertex) {
         Triangle& tri = pool[otri.tri];
-        tri.v[(otri.orient+1) % 3] = vertex;
+        tri.v[OTriangle::plus1(otri.orient)] = vertex;
     }
     inline void setDest(OTriangle& otri, int vertex) {
         Triangle& tri = pool[otri.tri];
-        tri.v[(otri.orient+2) % 3] = vertex;
+        tri.v[OTriangle::minus1(otri.orient)] = vertex;
     }
 
     inline void bind(OTriangle& otri1, OTriangle& otri2) {
@@ -144,6 +243,30 @@ private:
 
 inline void TrianglePool::clear()
     {pool.clear();}
+inline bool TrianglePool::reserve(size_t count) {
+    if (count > MAX_TRIANGLES)
+    {
+        std::cerr << "Too many triangles: " << count << std::endl;
+        return false;
+    }
+    pool.reserve(count);
+    return true;
+}
+inline void TrianglePool::shrinkToFit()
+    {pool.shrink_to_fit();}
+inline int TrianglePool::size() const
+    {return pool.size();}
+inline int TrianglePool::capacity() const
+    {return pool.capacity();}
+
+inline const std::vector<Triangle>& TrianglePool::triangles() const
+    {return pool;}
+inline void TrianglePool::setTriangles(std::vector<Triangle>&& triangles) {
+#ifdef ENABLE_GEOMETRIC_ASSERT
+    assert(triangles.size() <= MAX_TRIANGLES);
+#endif
+    pool = std::move(triangles);
+}
 
 inline int TrianglePool::getApex(const OTriangle& otri) const {
     const Triangle& tri = pool[otri.tri];
@@ -151,11 +274,11 @@ inline int TrianglePool::getApex(const OTriangle& otri) const {
 }
 inline int TrianglePool::getOrg(const OTriangle& otri) const {
     const Triangle& tri = pool[otri.tri];
-    return tri.v[(otri.orient+1) % 3];
+    return tri.v[OTriangle::plus1(otri.orient)];
 }
 inline int TrianglePool::getDest(const OTriangle& otri) const {
     const Triangle& tri = pool[otri.tri];
-    return tri.v[(otri.orient+2) % 3];
+    return tri.v[OTriangle::minus1(otri.orient)];
 }
 
 inline OTriangle TrianglePool::sym(const OTriangle& otri) const {
@@ -163,5 +286,13 @@ inline OTriangle TrianglePool::sym(const OTriangle& otri) const {
     return tri.getn(otri.orient);
 }
 
+// Links cleared by truncate() lead to ghosts too.
+inline bool TrianglePool::isGhost(const OTriangle& otri) const {
+    if (otri.tri < 0)
+        return true;
+    const Triangle& tri = pool[otri.tri];
+    return tri.v[0] < 0 || tri.v[1] < 0 || tri.v[2] < 0;
+}
+
 #endif
 
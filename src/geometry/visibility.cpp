@@ -0,0 +1,212 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#include "visibility.hpp"
+
+#include "astro.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Number of samples of the terrain queried at once, to bound memory.
+static constexpr unsigned int SAMPLE_BATCH = 1 << 16;
+
+template <typename P>
+BasicVisibility<P>::BasicVisibility(std::shared_ptr<const BasicDelaunay<P>> delaunay) :
+    mDelaunay(std::move(delaunay)), mMinX(0), mMinY(0)
+{
+    const std::vector<P>& points = mDelaunay->points();
+    if (points.empty())
+        return;
+
+    double scale = 1 << VISIBILITY_GRID_ZOOM;
+    auto cell = [scale](double x) {return static_cast<int>(std::floor(x * scale));};
+
+    int maxX = std::numeric_limits<int>::min();
+    int maxY = maxX;
+    mMinX = std::numeric_limits<int>::max();
+    mMinY = mMinX;
+    for (auto& p : points)
+    {
+        Point q = Mercator<P>::to(p);
+        mMinX = std::min(mMinX, cell(q.x));
+        mMinY = std::min(mMinY, cell(q.y));
+        maxX = std::max(maxX, cell(q.x));
+        maxY = std::max(maxY, cell(q.y));
+    }
+
+    // Each triangle raises the cells of its bounding box to its highest
+    // vertex, which bounds the terrain over these cells.
+    Level level;
+    level.width = maxX - mMinX + 1;
+    level.height = maxY - mMinY + 1;
+    level.heights.assign(level.width * level.height, -std::numeric_limits<float>::infinity());
+    mDelaunay->iterTrianglesIndices([&](unsigned int a, unsigned int b, unsigned int c){
+        Point pa = Mercator<P>::to(points[a]);
+        Point pb = Mercator<P>::to(points[b]);
+        Point pc = Mercator<P>::to(points[c]);
+        int x0 = cell(std::min({pa.x, pb.x, pc.x})) - mMinX;
+        int y0 = cell(std::min({pa.y, pb.y, pc.y})) - mMinY;
+        int x1 = cell(std::max({pa.x, pb.x, pc.x})) - mMinX;
+        int y1 = cell(std::max({pa.y, pb.y, pc.y})) - mMinY;
+        float z = std::max({pa.z, pb.z, pc.z});
+        for (int y = y0 ; y <= y1 ; ++y)
+            for (int x = x0 ; x <= x1 ; ++x)
+            {
+                float& height = level.heights[y * level.width + x];
+                height = std::max(height, z);
+            }
+    });
+    mLevels.push_back(std::move(level));
+
+    while (mLevels.back().width > 1 || mLevels.back().height > 1)
+    {
+        const Level& finer = mLevels.back();
+        Level coarser;
+        coarser.width = (finer.width + 1) / 2;
+        coarser.height = (finer.height + 1) / 2;
+        coarser.heights.assign(coarser.width * coarser.height, -std::numeric_limits<float>::infinity());
+        for (int y = 0 ; y < finer.height ; ++y)
+            for (int x = 0 ; x < finer.width ; ++x)
+            {
+                float& height = coarser.heights[(y / 2) * coarser.width + x / 2];
+                height = std::max(height, finer.heights[y * finer.width + x]);
+            }
+        mLevels.push_back(std::move(coarser));
+    }
+}
+
+template <typename P>
+float BasicVisibility<P>::maxHeight(unsigned int level, double x0, double y0, double x1, double y1) const
+{
+    const Level& l = mLevels[level];
+    double size = 1 << level;
+    int cx0 = std::max(static_cast<int>(std::floor(x0 / size)), 0);
+    int cy0 = std::max(static_cast<int>(std::floor(y0 / size)), 0);
+    int cx1 = std::min(static_cast<int>(std::floor(x1 / size)), l.width - 1);
+    int cy1 = std::min(static_cast<int>(std::floor(y1 / size)), l.height - 1);
+
+    float result = -std::numeric_limits<float>::infinity();
+    for (int y = cy0 ; y <= cy1 ; ++y)
+        for (int x = cx0 ; x <= cx1 ; ++x)
+            result = std::max(result, l.heights[y * l.width + x]);
+    return result;
+}
+
+template <typename P>
+std::vector<bool> BasicVisibility<P>::compute(const Point& eye, const std::vector<Point>& targets) const
+{
+    /* constexpr */ double pi = std::atan(1)*4;
+    std::vector<bool> visible(targets.size(), true);
+    if (mLevels.empty())
+        return visible;
+
+    double scale = 1 << VISIBILITY_GRID_ZOOM;
+    double metersPerUnit = 2*pi*EARTH_RADIUS * std::cos(Astro::mercatorToLatDeg(eye) * pi / 180.0);
+
+    // Samples of the terrain below the rays, with the height of the ray and
+    // the target of each one.
+    std::vector<Point> queries;
+    std::vector<double> rayHeights;
+    std::vector<unsigned int> owners;
+    auto flush = [&] {
+        std::vector<double> heights(queries.size());
+        mDelaunay->findTrianglePoints(queries.data(), queries.size(), heights.data());
+        for (unsigned int k = 0 ; k < queries.size() ; ++k)
+            if (heights[k] > rayHeights[k])
+                visible[owners[k]] = false;
+        queries.clear();
+        rayHeights.clear();
+        owners.clear();
+    };
+
+    double ax = eye.x * scale - mMinX;
+    double ay = eye.y * scale - mMinY;
+    for (unsigned int i = 0 ; i < targets.size() ; ++i)
+    {
+        const Point& target = targets[i];
+        double bx = target.x * scale - mMinX;
+        double by = target.y * scale - mMinY;
+        double length = std::sqrt((target - eye).dist2()) * metersPerUnit;
+
+        // Elevation of the ray is a + b*t + c*t^2 at parameter t in [0, 1],
+        // where the curvature of the Earth lowers the middle of the ray.
+        double a = eye.z;
+        double b = target.z - eye.z;
+        double c = 0;
+#ifdef USE_EARTH_CURVATURE
+        c = length * length / (2.0 * EARTH_RADIUS);
+        b -= c;
+#endif
+        auto rayHeight = [a, b, c](double t) {return a + t * (b + t * c);};
+        auto minRayHeight = [&](double t0, double t1) {
+            double t = c > 0 ? std::min(std::max(-b / (2.0 * c), t0), t1) : t0;
+            return std::min({rayHeight(t0), rayHeight(t), rayHeight(t1)});
+        };
+
+        // Parts of the ray are split until they are above the pyramid, or
+        // within a cell of the finest level.
+        std::vector<std::pair<double, double>> ranges = {{0, 1}};
+        while (!ranges.empty())
+        {
+            double t0 = ranges.back().first;
+            double t1 = ranges.back().second;
+            ranges.pop_back();
+
+            double x0 = ax + t0 * (bx - ax);
+            double y0 = ay + t0 * (by - ay);
+            double x1 = ax + t1 * (bx - ax);
+            double y1 = ay + t1 * (by - ay);
+            double extent = std::max(std::abs(x1 - x0), std::abs(y1 - y0));
+            unsigned int level = 0;
+            while (level + 1 < mLevels.size() && (1 << level) < extent)
+                ++level;
+
+            float terrain = this->maxHeight(level, std::min(x0, x1), std::min(y0, y1), std::max(x0, x1), std::max(y0, y1));
+            if (terrain <= minRayHeight(t0, t1))
+                continue;
+
+            if (level > 0)
+            {
+                double tm = (t0 + t1) / 2.0;
+                ranges.emplace_back(t0, tm);
+                ranges.emplace_back(tm, t1);
+                continue;
+            }
+
+            unsigned int count = std::max(1.0, std::ceil((t1 - t0) * length / VISIBILITY_SAMPLE_STEP));
+            for (unsigned int k = 0 ; k < count ; ++k)
+            {
+                double t = t0 + (k + 0.5) * (t1 - t0) / count;
+                queries.push_back(eye + (target - eye) * t);
+                rayHeights.push_back(rayHeight(t));
+                owners.push_back(i);
+            }
+        }
+
+        if (queries.size() >= SAMPLE_BATCH)
+            flush();
+    }
+    flush();
+
+    return visible;
+}
+
+template class BasicVisibility<Point>;
+template class BasicVisibility<TilePoint>;
@@ -0,0 +1,64 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#ifndef VISIBILITY_HPP
+#define VISIBILITY_HPP
+
+#include "delaunay.hpp"
+#include <memory>
+#include <vector>
+
+// Visibility of points from an eye, by casting rays against a triangulated
+// terrain.  A pyramid of the maximal elevation over a grid skips the parts of
+// rays that are clearly above the ground, and the other parts are sampled
+// with the triangulation.
+template <typename P>
+class BasicVisibility
+{
+public:
+    explicit BasicVisibility(std::shared_ptr<const BasicDelaunay<P>> delaunay);
+
+    // Whether the segment from the eye to each target is above the terrain, in
+    // Mercator coordinates with elevations in meters.  Parts of the segments
+    // outside of the triangulation never hide targets.
+    std::vector<bool> compute(const Point& eye, const std::vector<Point>& targets) const;
+
+private:
+    // Maximal elevation of the terrain over each cell of the grid, with cells
+    // twice as large at each level.
+    struct Level {
+        int width;
+        int height;
+        std::vector<float> heights;
+    };
+
+    // Maximal elevation over the cells of a level that intersect the box
+    // [x0, x1] x [y0, y1], in units of cells of the finest level.
+    float maxHeight(unsigned int level, double x0, double y0, double x1, double y1) const;
+
+    std::shared_ptr<const BasicDelaunay<P>> mDelaunay;
+    // Tile at VISIBILITY_GRID_ZOOM of the first cell of the finest level.
+    int mMinX;
+    int mMinY;
+    std::vector<Level> mLevels;
+};
+
+typedef BasicVisibility<Point> Visibility;
+typedef BasicVisibility<TilePoint> TileVisibility;
+
+#endif
@@ -19,10 +19,16 @@
 #include "worldmodel.hpp"
 
 #include "geometry/astro.hpp"
+#include "geometry/simplifier.hpp"
+#include "protobuf/mvt.hpp"
+#include "protobuf/triangulation.pb.h"
 #include "protobuf/xyz.pb.h"
 #include "config.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
 
 WorldModel::WorldModel(std::shared_ptr<Database> database) :
     mDatabase(database),
@@ -53,10 +59,10 @@ void WorldModel::loadLatLon(double lat, double lon, int zoom)
             });
         }
 
-        // Request labels.
+        // Request labels, for the chunks under the tiles.
         auto self(shared_from_this());
-        TaskManager::manager.launch([this, self] {
-            this->loadGlobalLabels();
+        TaskManager::manager.launch([this, self, tilelist] {
+            this->loadLabels(tilelist);
         });
 
         unsigned int countMessages = 0;
@@ -77,6 +83,7 @@ void WorldModel::loadLatLon(double lat, double lon, int zoom)
             }
 
             // Transfer all available messages.
+            unsigned int tileCount = mTiles.size();
             unsigned int failedMessages = 0;
             for (auto&& msg : messages)
             {
@@ -99,59 +106,145 @@ void WorldModel::loadLatLon(double lat, double lon, int zoom)
                 std::cerr << "Received " << failedMessages << " failures." << std::endl;
 
             // Update 3D model.
-            Polygon points;
-            for (auto& tile : mTiles)
-                for (auto& p : tile.points)
-                    points.push_back(p);
+            std::shared_ptr<TileDelaunay> delaunay = mDelaunay.get();
+            unsigned int pointCount = 0;
+            unsigned int newPointCount = 0;
+            for (unsigned int i = 0 ; i < mTiles.size() ; ++i)
+            {
+                unsigned int count = mTiles[i].fragment.points.size();
+                pointCount += count;
+                if (i >= tileCount)
+                    newPointCount += count;
+            }
 
-            std::cerr << "########## Updating (" << countMessages << "/" << (tilelist.size() + 1) << ") ########## with " << mTiles.size() << " tiles and " << points.size() << " points." << std::endl;
+            std::cerr << "########## Updating (" << countMessages << "/" << (tilelist.size() + 1) << ") ########## with " << mTiles.size() << " tiles and " << pointCount << " points." << std::endl;
 
-            if (points.size() < 3)
+            if (pointCount < 3)
             {
                 std::cerr << "Less than 3 points, skipping..." << std::endl;
                 continue;
             }
 
-            auto delaunay = std::make_shared<Delaunay>(std::move(points), true);
+            // Stitch the triangulations of all tiles, unless the new tiles
+            // are a small part of the model.
+            std::vector<TilePoint> newPoints;
+            if (!delaunay || 2 * newPointCount >= pointCount)
+            {
+                std::vector<const TileDelaunay::Fragment*> fragments;
+                for (auto& tile : mTiles)
+                    fragments.push_back(&tile.fragment);
+                // The mesh is made of chunks, so the order of the model only
+                // matters to queries, which walk from the quadtree.
+                TileDelaunay::Options options;
+                options.reorder = false;
+                delaunay = std::make_shared<TileDelaunay>(std::move(fragments), options);
+                mSpareDelaunay.reset();
+                mSparePoints.clear();
+            }
+            else if (newPointCount > 0)
+            {
+                for (unsigned int i = tileCount ; i < mTiles.size() ; ++i)
+                    for (auto& p : mTiles[i].fragment.points)
+                        newPoints.push_back(p);
+
+                // The current model may be in use by the UI thread.  Catch up
+                // the previous model instead, unless something still holds it.
+                std::vector<TilePoint> points = std::move(mSparePoints);
+                std::shared_ptr<TileDelaunay> spare = std::move(mSpareDelaunay);
+                if (spare && spare.use_count() == 1)
+                {
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    delaunay = std::move(spare);
+                    points.insert(points.end(), newPoints.begin(), newPoints.end());
+                }
+                else
+                {
+                    delaunay = std::make_shared<TileDelaunay>(*delaunay);
+                    points = newPoints;
+                }
+                delaunay->insert(std::move(points));
+            }
 
             // Update labels.
             unsigned int labelCount = 0;
+            std::shared_ptr<LabelSet> visibleLabels;
+            std::shared_ptr<std::vector<Point>> targets;
             if (mLabels)
             {
-                std::vector<Label> labels;
+                std::vector<unsigned int> indices;
                 for (auto& tile : mTiles)
-                    mLabels->filter(tile.tileInfo, labels);
-                std::cerr << "Filtered " << labels.size() << " labels for " << mTiles.size() << " tiles." << std::endl;
-
-                // Adjust to model view
-                auto visibleLabels = std::make_shared<std::vector<Label>>();
-                for (const Label& l : labels)
+                    mLabels->filter(tile.tileInfo, indices);
+                std::cerr << "Filtered " << indices.size() << " labels for " << mTiles.size() << " tiles." << std::endl;
+
+                std::vector<Point> points;
+                points.reserve(indices.size());
+                for (unsigned int i : indices)
+                    points.push_back(mLabels->point(i));
+                std::vector<double> heights(indices.size());
+                unsigned int found = delaunay->findTrianglePoints(points.data(), points.size(), heights.data());
+
+                // Sort labels by priority (elevation, or height of the
+                // terrain if unknown).
+                std::vector<std::pair<double, unsigned int>> order;
+                order.reserve(found);
+                for (unsigned int k = 0 ; k < indices.size() ; ++k)
                 {
-                    auto found = delaunay->findTrianglePoint(l.point);
-                    if (found)
-                    {
-                        visibleLabels->push_back(l);
-                        Point& p = visibleLabels->back().point;
-                        p.z = found->z;
-                        p = Astro::mercatorToModel(p, origin);
-                    }
+                    if (std::isnan(heights[k]))
+                        continue;
+                    const Labels::Record& record = mLabels->record(indices[k]);
+                    order.emplace_back(record.hasElevation ? record.elevation : heights[k], k);
+                }
+                std::stable_sort(order.begin(), order.end(),
+                                 [](const std::pair<double, unsigned int>& lhs, const std::pair<double, unsigned int>& rhs) {return lhs.first > rhs.first;});
+
+                // Rays aim a bit above the labels, in Mercator coordinates.
+                visibleLabels = std::make_shared<LabelSet>();
+                visibleLabels->labels = mLabels;
+                visibleLabels->indices.reserve(order.size());
+                visibleLabels->points.reserve(order.size());
+                targets = std::make_shared<std::vector<Point>>();
+                targets->reserve(order.size());
+                for (auto& o : order)
+                {
+                    Point p = points[o.second];
+                    p.z = heights[o.second];
+                    visibleLabels->indices.push_back(indices[o.second]);
+                    targets->push_back(p + Point(0, 0, LABEL_VISIBILITY_HEIGHT));
+                    // Adjust to model view
+                    visibleLabels->points.push_back(Astro::mercatorToModel(p, origin));
                 }
 
-                // Sort labels by priority (elevation)
-                std::sort(visibleLabels->begin(), visibleLabels->end(),
-                          [](const Label& lhs, const Label& rhs) {return lhs.elevationEstimate() > rhs.elevationEstimate();});
-
-                labelCount = visibleLabels->size();
-                mVisibleLabels.swap(visibleLabels);
+                labelCount = visibleLabels->indices.size();
             }
 
             // Prepare mesh in this thread to avoid blocking the main thread
-            std::shared_ptr<Mesh> mesh = WorldModel::makeMesh(*delaunay, origin);
+            std::shared_ptr<Mesh> mesh = WorldModel::makeMesh(mTiles, *delaunay, origin);
             mesh->tileCount = mTiles.size();
             mesh->labelCount = labelCount;
 
+            // Pyramid of the terrain, to test the visibility of labels.
+            auto engine = std::make_shared<const TileVisibility>(delaunay);
+            auto setInputs = [&engine, &visibleLabels, &targets](VisibilityState& state) {
+                state.engine = std::move(engine);
+                if (visibleLabels)
+                {
+                    state.labels = visibleLabels;
+                    state.targets = std::move(targets);
+                }
+            };
+            mVisibilityState.apply(setInputs);
+
+            if (visibleLabels)
+                mVisibleLabels.swap(visibleLabels);
             mDelaunay.swap(delaunay);
             mMesh.swap(mesh);
+            if (!newPoints.empty())
+            {
+                // The replaced model misses only the new points.
+                mSpareDelaunay = std::move(delaunay);
+                mSparePoints = std::move(newPoints);
+            }
+            this->updateVisibility();
 
             std::cerr << "New mesh available" << std::endl;
 
@@ -164,35 +257,323 @@ void WorldModel::loadLatLon(double lat, double lon, int zoom)
     });
 }
 
-std::shared_ptr<WorldModel::Mesh> WorldModel::makeMesh(const Delaunay& delaunay, const Point& origin)
+void WorldModel::setEye(const Point& eye)
 {
-    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
-    std::vector<Point> points;
-    mesh->pointCount = delaunay.iterPoints([&](const Point& p){
-        Point q = Astro::mercatorToModel(p, origin);
-        points.push_back(q);
-        mesh->vertices.push_back(q.x);
-        mesh->vertices.push_back(q.y);
-        mesh->vertices.push_back(q.z);
+    auto setEye = [&eye](VisibilityState& state) {
+        state.eye = eye;
+        state.eyeKnown = true;
+    };
+    mVisibilityState.apply(setEye);
+    this->updateVisibility();
+}
+
+void WorldModel::updateVisibility()
+{
+    // A single task computes the visibility, until it is up to date with the
+    // last inputs.
+    bool launch = false;
+    auto markDirty = [&launch](VisibilityState& state) {
+        state.dirty = true;
+        launch = !state.running && state.eyeKnown && state.engine && state.labels;
+        if (launch)
+            state.running = true;
+    };
+    mVisibilityState.apply(markDirty);
+    if (!launch)
+        return;
+
+    auto self(shared_from_this());
+    TaskManager::manager.launch([this, self] {
+        for (;;)
+        {
+            VisibilityState inputs;
+            auto take = [&inputs](VisibilityState& state) {
+                state.running = state.dirty;
+                state.dirty = false;
+                inputs = state;
+            };
+            mVisibilityState.apply(take);
+            if (!inputs.running)
+                break;
+
+            auto visibility = std::make_shared<LabelVisibility>();
+            visibility->labels = inputs.labels;
+            visibility->eye = inputs.eye;
+            visibility->visible = inputs.engine->compute(inputs.eye, *inputs.targets);
+            mLabelVisibility.set(std::move(visibility));
+
+            auto call = [] (std::function<void()>& f) {if (f) f();};
+            mVisibilityChanged.apply(call);
+        }
+    });
+}
+
+// Douglas-Peucker on the elevation along a run of border samples, which are
+// on a vertical or horizontal line.  The result does not depend on the
+// direction of the run, so that neighboring chunks agree.
+static std::vector<TilePoint> simplifyBorder(std::vector<TilePoint> run, double tolerance)
+{
+    bool reversed = run.front().x + run.front().y > run.back().x + run.back().y;
+    if (reversed)
+        std::reverse(run.begin(), run.end());
+
+    unsigned int n = run.size();
+    std::vector<char> keep(n, false);
+    keep[0] = keep[n - 1] = true;
+    std::vector<std::pair<unsigned int, unsigned int>> ranges = {{0, n - 1}};
+    while (!ranges.empty())
+    {
+        unsigned int first = ranges.back().first;
+        unsigned int last = ranges.back().second;
+        ranges.pop_back();
+
+        const TilePoint& a = run[first];
+        const TilePoint& b = run[last];
+        double length = (b.x - a.x) + (b.y - a.y);
+        double worst = tolerance;
+        unsigned int index = 0;
+        for (unsigned int i = first + 1 ; i < last ; ++i)
+        {
+            double t = ((run[i].x - a.x) + (run[i].y - a.y)) / length;
+            double error = std::abs(run[i].z - (a.z + t * (b.z - a.z)));
+            if (error > worst)
+            {
+                worst = error;
+                index = i;
+            }
+        }
+
+        if (index)
+        {
+            keep[index] = true;
+            ranges.emplace_back(first, index);
+            ranges.emplace_back(index, last);
+        }
+    }
+
+    std::vector<TilePoint> result;
+    for (unsigned int i = 0 ; i < n ; ++i)
+        if (keep[i])
+            result.push_back(run[i]);
+    if (reversed)
+        std::reverse(result.begin(), result.end());
+    return result;
+}
+
+// Vertex in model coordinates, with its Mercator elevation for the spherical
+// shader.
+static void addVertex(WorldModel::Mesh::Chunk& chunk, const Point& p, const Point& q, const Point& normal)
+{
+    chunk.vertices.push_back(q.x);
+    chunk.vertices.push_back(q.y);
+    chunk.vertices.push_back(q.z);
 #ifdef USE_EARTH_CURVATURE
-        mesh->vertices.push_back(p.z);
+    chunk.vertices.push_back(p.z);
 #endif
-    });
-    delaunay.iterNormals(points, [&](const Point& n){
-        // Changed Mercator orientation to direct orientation.
-        mesh->normals.push_back(-n.x);
-        mesh->normals.push_back(-n.y);
-        mesh->normals.push_back(-n.z);
-    });
-    mesh->triangleCount = delaunay.iterTrianglesIndices([&](unsigned int a, unsigned int b, unsigned int c){
-        // Changed Mercator orientation to direct orientation.
-        mesh->indices.push_back(a);
-        mesh->indices.push_back(c);
-        mesh->indices.push_back(b);
-    });
+    chunk.normals.push_back(normal.x);
+    chunk.normals.push_back(normal.y);
+    chunk.normals.push_back(normal.z);
+    ++chunk.pointCount;
+}
+
+std::shared_ptr<WorldModel::Mesh> WorldModel::makeMesh(std::vector<Tile>& tiles, const TileDelaunay& delaunay, const Point& origin)
+{
+    // Elevation along the borders of tiles, from the full triangulation.
+    // Samples of each border are in counter-clockwise order in the model
+    // (north up): west, south, east and north borders.
+    std::vector<TilePoint> samples;
+    for (auto& tile : tiles)
+    {
+        const TileDelaunay::Fragment& fragment = tile.fragment;
+        int minx = fragment.minx;
+        int miny = fragment.miny;
+        int maxx = fragment.maxx;
+        int maxy = fragment.maxy;
+        int step = (maxx - minx) / MESH_LOD_BORDER_SAMPLES;
+        for (int i = 0 ; i <= MESH_LOD_BORDER_SAMPLES ; ++i)
+            samples.emplace_back(minx, miny + i * step);
+        for (int i = 0 ; i <= MESH_LOD_BORDER_SAMPLES ; ++i)
+            samples.emplace_back(minx + i * step, maxy);
+        for (int i = 0 ; i <= MESH_LOD_BORDER_SAMPLES ; ++i)
+            samples.emplace_back(maxx, maxy - i * step);
+        for (int i = 0 ; i <= MESH_LOD_BORDER_SAMPLES ; ++i)
+            samples.emplace_back(maxx - i * step, miny);
+    }
+
+    std::vector<Point> queries;
+    queries.reserve(samples.size());
+    for (auto& p : samples)
+        queries.push_back(p.toMercator());
+    std::vector<double> heights(queries.size());
+    delaunay.findTrianglePoints(queries.data(), queries.size(), heights.data());
+
+    // Each tile is a chunk, made again only if its borders changed.
+    std::vector<std::function<void()>> jobs;
+    for (unsigned int t = 0 ; t < tiles.size() ; ++t)
+    {
+        jobs.emplace_back([&, t] {
+            // Runs of samples inside the triangulation, on one border each.
+            std::vector<std::vector<TilePoint>> borders;
+            for (unsigned int side = 0 ; side < 4 ; ++side)
+            {
+                borders.emplace_back();
+                for (unsigned int i = 0 ; i <= MESH_LOD_BORDER_SAMPLES ; ++i)
+                {
+                    unsigned int index = (4*t + side) * (MESH_LOD_BORDER_SAMPLES + 1) + i;
+                    if (std::isnan(heights[index]))
+                    {
+                        if (!borders.back().empty())
+                            borders.emplace_back();
+                        continue;
+                    }
+                    borders.back().push_back(samples[index]);
+                    borders.back().back().z = std::lround(heights[index]);
+                }
+                if (borders.back().empty())
+                    borders.pop_back();
+            }
+
+            Tile& tile = tiles[t];
+            if (tile.chunk && borders == tile.chunkBorders)
+                return;
+            tile.chunk = WorldModel::makeChunk(tile, borders, origin);
+            tile.chunkBorders = std::move(borders);
+        });
+    }
+    TaskManager::manager.parallel(jobs);
+
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>();
+    for (auto& tile : tiles)
+    {
+        mesh->pointCount += tile.chunk->pointCount;
+        mesh->triangleCount += tile.chunk->triangleCount;
+        mesh->chunks.push_back(tile.chunk);
+    }
+
+    std::cerr << "Mesh of " << mesh->chunks.size() << " chunk(s) with " << mesh->pointCount << " point(s)" << std::endl;
     return mesh;
 }
 
+std::shared_ptr<WorldModel::Mesh::Chunk> WorldModel::makeChunk(const Tile& tile, const std::vector<std::vector<TilePoint>>& borders, const Point& origin)
+{
+    const TileDelaunay::Fragment& fragment = tile.fragment;
+    std::shared_ptr<Mesh::Chunk> chunk = std::make_shared<Mesh::Chunk>();
+    chunk->tileInfo = tile.tileInfo;
+
+    auto onBorder = [&fragment](const TilePoint& p) {
+        return p.x == fragment.minx || p.y == fragment.miny || p.x == fragment.maxx || p.y == fragment.maxy;
+    };
+
+    // Points on the borders are replaced by the samples.
+    std::vector<TilePoint> interior;
+    for (auto& p : fragment.points)
+        if (p.x != fragment.minx && p.y != fragment.miny)
+            interior.push_back(p);
+
+    Point min(0, 0, 0);
+    Point max(0, 0, 0);
+    double tolerance = MESH_MAX_ERROR;
+    double previousTolerance = 0;
+    double skirtDepth = MESH_MAX_ERROR * std::pow(MESH_LOD_RATIO, MESH_LOD_LEVELS - 1);
+    for (int level = 0 ; level < MESH_LOD_LEVELS ; ++level, previousTolerance = tolerance, tolerance *= MESH_LOD_RATIO)
+    {
+        chunk->levels.emplace_back(chunk->indices.size(), 0);
+
+        // Borders are simplified first, and all their points are kept.
+        std::vector<TilePoint> points = interior;
+        std::vector<std::vector<TilePoint>> levelBorders;
+        for (auto& run : borders)
+        {
+            levelBorders.push_back(simplifyBorder(run, tolerance));
+            points.insert(points.end(), levelBorders.back().begin(), levelBorders.back().end());
+        }
+        if (points.size() < 3)
+            continue;
+
+        // Each level simplifies the previous one, whose surface is within
+        // the previous tolerance, so the rest of the tolerance is left.
+        TrianglePool pool;
+        points = Simplifier::simplify<TilePoint>(points, [&](const TilePoint& p){ return onBorder(p) ? 0.0 : tolerance - previousTolerance; }, &pool);
+        if (pool.size() == 0)
+            continue;
+        interior.clear();
+        for (auto& p : points)
+            if (!onBorder(p))
+                interior.push_back(p);
+
+        // Queried once, in the order of the simplifier.
+        TileDelaunay::Options options;
+        options.quadtree = false;
+        options.parallel = false;
+        options.reorder = false;
+        options.ghosts = false;
+        TileDelaunay delaunay(std::move(points), std::move(pool), options);
+
+        unsigned int firstVertex = chunk->pointCount;
+        std::vector<Point> mercator;
+        std::vector<Point> model;
+        delaunay.iterPoints([&](const Point& p){
+            mercator.push_back(p);
+            model.push_back(Astro::mercatorToModel(p, origin));
+        });
+        unsigned int i = 0;
+        delaunay.iterNormals(model, [&](const Point& n){
+            // Changed Mercator orientation to direct orientation.
+            addVertex(*chunk, mercator[i], model[i], Point(-n.x, -n.y, -n.z));
+            ++i;
+        });
+        chunk->triangleCount += delaunay.iterTrianglesIndices([&](unsigned int a, unsigned int b, unsigned int c){
+            // Changed Mercator orientation to direct orientation.
+            chunk->indices.push_back(firstVertex + a);
+            chunk->indices.push_back(firstVertex + c);
+            chunk->indices.push_back(firstVertex + b);
+        });
+
+        // Skirts hang below the borders, facing outwards, deep enough to hide
+        // cracks with neighbors at any level.
+        for (auto& run : levelBorders)
+        {
+            for (unsigned int k = 0 ; k < run.size() ; ++k)
+            {
+                Point p = run[k].toMercator();
+                Point q = Astro::mercatorToModel(p, origin);
+                Point up = Astro::mercatorToModel(p + Point(0, 0, 1), origin) - q;
+                Point bottom = p - Point(0, 0, tolerance + skirtDepth);
+                unsigned int u = chunk->pointCount;
+                addVertex(*chunk, p, q, up);
+                addVertex(*chunk, bottom, Astro::mercatorToModel(bottom, origin), up);
+                if (k == 0)
+                    continue;
+                // Top and bottom of the previous sample are u-2 and u-1.
+                for (unsigned int v : {u - 2, u - 1, u + 1, u - 2, u + 1, u})
+                    chunk->indices.push_back(v);
+                chunk->triangleCount += 2;
+            }
+        }
+
+        chunk->levels.back().second = chunk->indices.size() - chunk->levels.back().first;
+
+        if (level == 0)
+        {
+            min = max = model.front();
+            for (auto& q : model)
+            {
+                min.x = std::min(min.x, q.x);
+                min.y = std::min(min.y, q.y);
+                min.z = std::min(min.z, q.z);
+                max.x = std::max(max.x, q.x);
+                max.y = std::max(max.y, q.y);
+                max.z = std::max(max.z, q.z);
+            }
+            chunk->center = (min + max) / 2.0;
+            for (auto& q : model)
+                chunk->radius = std::max(chunk->radius, std::sqrt((q - chunk->center).dist3()));
+        }
+    }
+
+    return chunk;
+}
+
 
 std::vector<TileInfo> WorldModel::genTileList(int x, int y, int zoom)
 {
@@ -243,17 +624,26 @@ std::vector<TileInfo> WorldModel::genTileList(int x, int y, int zoom)
     return result;
 }
 
-void WorldModel::loadGlobalLabels()
+void WorldModel::loadLabels(const std::vector<TileInfo>& tiles)
 {
     std::cerr << "########## Loading labels... ##########" << std::endl;
-    std::unique_ptr<Labels> labels;
-
-    std::unique_ptr<std::ifstream> ifs = mDatabase->loadLabels();
-    if (ifs)
+    std::shared_ptr<const Labels> labels = mDatabase->loadLabels();
+    if (labels)
     {
-        labels = std::make_unique<Labels>();
-        labels->load(*ifs);
-        std::cerr << "########## Loaded labels! ##########" << std::endl;
+        // Only the chunks of the area are read, concurrently with the tiles.
+        // Labels::filter() would load them anyway, but later and one by one.
+        std::vector<unsigned int> chunks;
+        for (auto& tile : tiles)
+            labels->chunks(tile, chunks);
+        std::sort(chunks.begin(), chunks.end());
+        chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+
+        std::vector<std::function<void()>> jobs;
+        for (unsigned int chunk : chunks)
+            jobs.push_back([&labels, chunk] {labels->loadChunk(chunk);});
+        TaskManager::manager.parallel(jobs);
+
+        std::cerr << "########## Loaded labels (" << chunks.size() << " chunks)! ##########" << std::endl;
     }
     else
         std::cerr << "########## Could not load labels ##########" << std::endl;
@@ -271,59 +661,102 @@ void WorldModel::load(int zoom, int x, int y, bool retry)
     int zz = 1 << zoom;
     int xx = (x + zz) % zz; // clip to range [0, 2^zoom-1]
     int yy = y;
-    double scale = 1.0 / (4096.0 * zz);
-
-    panoramix::XYZ xyz;
-    bool valid = true;
 
-    std::unique_ptr<std::ifstream> ifs = mDatabase->loadSimple(zoom, xx, yy, "xyz");
-    if (ifs)
+    // Integer coordinates are exact up to INTEGER_ZOOM.
+    Tile tile;
+    int scale = TilePoint::tileScale(zoom);
+    if (!scale)
     {
-        valid = xyz.ParseFromIstream(ifs.get());
-        if (!valid)
-            std::cerr << "Error parsing xyz: " << zoom << ", " << xx << ", " << yy << std::endl;
+        std::cerr << "Zoom too large: " << zoom << ", " << xx << ", " << yy << std::endl;
+        this->postTile(std::move(tile), false);
+        return;
     }
-    else
+
+    bool valid = this->loadFragment(zoom, xx, yy, tile.fragment);
+
+    if (!valid)
     {
-        if (retry)
+        panoramix::XYZ xyz;
+        valid = true;
+
+        std::unique_ptr<std::ifstream> ifs = mDatabase->loadSimple(zoom, xx, yy, "xyz");
+        if (ifs)
         {
-            auto self(shared_from_this());
-            mDatabase->loadMvt(zoom, x, y,
-            // onSuccess
-            [this, self, zoom, x, y, xx, yy] (const std::string& content) {
-                this->tile2xyz(zoom, xx, yy, content);
-                this->load(zoom, x, y, false);
-            },
-            // onError
-            [this, self, zoom, x, y] {
-                this->load(zoom, x, y, false);
-            });
-            return;
+            valid = xyz.ParseFromIstream(ifs.get());
+            if (!valid)
+                std::cerr << "Error parsing xyz: " << zoom << ", " << xx << ", " << yy << std::endl;
+            else if (retry && xyz.tolerance() != CONTOUR_TOLERANCE)
+            {
+                // Simplified with another tolerance, download again.
+                ifs.reset();
+                xyz.Clear();
+            }
         }
-        else
+
+        if (!ifs)
         {
-            std::cerr << "Could not find/simplify xyz: " << zoom << ", " << xx << ", " << yy << std::endl;
-            valid = false;
+            if (retry)
+            {
+                auto self(shared_from_this());
+                mDatabase->loadMvt(zoom, x, y,
+                // onSuccess
+                [this, self, zoom, x, y, xx, yy] (const std::string& content) {
+                    this->tile2xyz(zoom, xx, yy, content);
+                    this->load(zoom, x, y, false);
+                },
+                // onError
+                [this, self, zoom, x, y] {
+                    this->load(zoom, x, y, false);
+                });
+                return;
+            }
+            else
+            {
+                std::cerr << "Could not find/simplify xyz: " << zoom << ", " << xx << ", " << yy << std::endl;
+                valid = false;
+            }
+        }
+
+        if (valid)
+        {
+            // TODO: assert that tile is indeed 4096x4096
+            // TODO: check multiple of 3
+            std::vector<TilePoint> points;
+            for (int i = 0 ; i+2 < xyz.points_size() ; i+=3)
+            {
+                // The last row and column belong to the next tiles, so that
+                // tiles can be triangulated independently.
+                if (xyz.points(i) < 4096 && xyz.points(i+1) < 4096)
+                    points.emplace_back(xyz.points(i), xyz.points(i+1), xyz.points(i+2));
+            }
+
+            tile.fragment = TileDelaunay::makeFragment(std::move(points));
+            this->storeFragment(zoom, xx, yy, tile.fragment, xyz.tolerance());
         }
     }
 
-    Tile tile;
     if (valid)
     {
-        // TODO: assert that tile is indeed 4096x4096
-        Point translate(x*4096, y*4096);
-
+        // Translation and scaling by a power of 2 keep the triangulation.
         tile.tileInfo = TileInfo(zoom, x, y);
-        // TODO: check multiple of 3
-        for (int i = 0 ; i+2 < xyz.points_size() ; i+=3)
+        for (auto& pt : tile.fragment.points)
         {
-            tile.points.emplace_back(xyz.points(i), xyz.points(i+1), xyz.points(i+2));
-            auto& pt = tile.points.back();
-            pt.add2(translate);
-            pt.scaleXY(scale);
+            pt.x = (x * 4096 + pt.x) * scale;
+            pt.y = (y * 4096 + pt.y) * scale;
         }
+
+        TileDelaunay::Fragment& fragment = tile.fragment;
+        fragment.minx = x * 4096 * scale;
+        fragment.miny = y * 4096 * scale;
+        fragment.maxx = (x + 1) * 4096 * scale;
+        fragment.maxy = (y + 1) * 4096 * scale;
     }
 
+    this->postTile(std::move(tile), valid);
+}
+
+void WorldModel::postTile(Tile&& tile, bool valid)
+{
     auto f = [t = std::move(tile), valid] (std::vector<Message>& queue) mutable {
         queue.emplace_back(Message::make_tile(std::move(t), valid));
     };
@@ -331,6 +764,87 @@ void WorldModel::load(int zoom, int x, int y, bool retry)
     mMsgQueue.notify_one();
 }
 
+bool WorldModel::loadFragment(int zoom, int x, int y, TileDelaunay::Fragment& fragment)
+{
+    std::unique_ptr<std::ifstream> ifs = mDatabase->loadSimple(zoom, x, y, "tri");
+    if (!ifs)
+        return false;
+
+    panoramix::Triangulation triangulation;
+    if (!triangulation.ParseFromIstream(ifs.get()))
+    {
+        std::cerr << "Error parsing triangulation: " << zoom << ", " << x << ", " << y << std::endl;
+        return false;
+    }
+    if (triangulation.tolerance() != CONTOUR_TOLERANCE)
+        return false;
+
+    int pointCount = triangulation.points_size() / 3;
+    int triangleCount = triangulation.vertices_size() / 3;
+    if (triangulation.points_size() % 3 || triangulation.vertices_size() % 3
+            || triangulation.neighbors_size() != triangulation.vertices_size()
+            || (pointCount >= 2 && (triangleCount == 0
+                                    || (triangulation.farleft() >> 2) >= triangleCount
+                                    || (triangulation.farright() >> 2) >= triangleCount)))
+    {
+        std::cerr << "Invalid triangulation: " << zoom << ", " << x << ", " << y << std::endl;
+        return false;
+    }
+
+    std::vector<Triangle> triangles(triangleCount);
+    for (int i = 0 ; i < triangleCount ; ++i)
+    {
+        for (int j = 0 ; j < 3 ; ++j)
+        {
+            int v = triangulation.vertices(3*i + j);
+            int n = triangulation.neighbors(3*i + j);
+            if (v < -1 || v >= pointCount || n < 0 || (n >> 2) >= triangleCount)
+            {
+                std::cerr << "Invalid triangulation: " << zoom << ", " << x << ", " << y << std::endl;
+                return false;
+            }
+            triangles[i].v[j] = v;
+            triangles[i].setn(j, OTriangle::decode(n));
+        }
+    }
+
+    fragment.points.clear();
+    for (int i = 0 ; i < pointCount ; ++i)
+        fragment.points.emplace_back(triangulation.points(3*i), triangulation.points(3*i+1), triangulation.points(3*i+2));
+    fragment.pool.setTriangles(std::move(triangles));
+    fragment.farleft = OTriangle::decode(triangulation.farleft());
+    fragment.farright = OTriangle::decode(triangulation.farright());
+    return true;
+}
+
+void WorldModel::storeFragment(int zoom, int x, int y, const TileDelaunay::Fragment& fragment, double tolerance)
+{
+    panoramix::Triangulation triangulation;
+    for (auto& p : fragment.points)
+    {
+        triangulation.add_points(p.x);
+        triangulation.add_points(p.y);
+        triangulation.add_points(p.z);
+    }
+    for (auto& t : fragment.pool.triangles())
+    {
+        for (int j = 0 ; j < 3 ; ++j)
+        {
+            triangulation.add_vertices(t.v[j]);
+            triangulation.add_neighbors(t.getn(j).encode());
+        }
+    }
+    triangulation.set_farleft(fragment.farleft.encode());
+    triangulation.set_farright(fragment.farright.encode());
+    triangulation.set_tolerance(tolerance);
+
+    auto ofs = mDatabase->storeSimple(zoom, x, y, "tri");
+    if (ofs)
+        triangulation.SerializeToOstream(ofs.get());
+    else
+        std::cerr << "Cannot write cache entry: " << zoom << ", " << x << ", " << y << std::endl;
+}
+
 void WorldModel::tile2xyz(int zoom, int x, int y, const std::string& content)
 {
     vector_tile::Tile tile;
@@ -345,13 +859,24 @@ void WorldModel::tile2xyz(int zoom, int x, int y, const std::string& content)
 
     if (!path.empty())
     {
+        // Each run of points inside the tile is simplified on its own, so
+        // that points outside don't shape it, and its ends are kept.
         Polygon points;
         for (auto& polygon : path)
-            for (auto& point : polygon)
-                if (Mvt::isValid(point))
-                    points.push_back(point);
+        {
+            for (auto it = polygon.begin() ; it != polygon.end() ; )
+            {
+                auto begin = std::find_if(it, polygon.end(), Mvt::isValid);
+                it = std::find_if_not(begin, polygon.end(), Mvt::isValid);
+                Polygon run;
+                run.assign(begin, it);
+                run.simplify(CONTOUR_TOLERANCE);
+                points.insert(points.end(), run.begin(), run.end());
+            }
+        }
 
         panoramix::XYZ xyz;
+        xyz.set_tolerance(CONTOUR_TOLERANCE);
         for (auto& p : points)
         {
             xyz.add_points(p.x);
@@ -24,6 +24,7 @@
 #include "util/concurrency.hpp"
 #include "geometry/delaunay.hpp"
 #include "geometry/labels.hpp"
+#include "geometry/visibility.hpp"
 
 class WorldModel : public std::enable_shared_from_this<WorldModel>
 {
@@ -36,27 +37,75 @@ public:
         Mesh() :
             pointCount(0), triangleCount(0), tileCount(0), labelCount(0) {}
 
-        std::vector<float> vertices;
-        std::vector<float> normals;
-        std::vector<unsigned int> indices;
+        // Part of the mesh over one tile, at several levels of detail, with
+        // its own buffers.  Successive meshes share the unchanged chunks.
+        struct Chunk {
+            Chunk() :
+                pointCount(0), triangleCount(0), center(0, 0, 0), radius(0) {}
+
+            TileInfo tileInfo;
+            std::vector<float> vertices;
+            std::vector<float> normals;
+            std::vector<unsigned int> indices;
+            unsigned int pointCount;
+            unsigned int triangleCount;
+            // Bounding sphere in model coordinates.
+            Point center;
+            double radius;
+            // First index and count of indices of each level (skirts
+            // included), from finest to coarsest.
+            std::vector<std::pair<unsigned int, unsigned int>> levels;
+        };
+
+        std::vector<std::shared_ptr<const Chunk>> chunks;
         unsigned int pointCount;
         unsigned int triangleCount;
         unsigned int tileCount;
         unsigned int labelCount;
     };
 
-    inline LockGuardedShared<std::vector<Label>>& visibleLabels();
-    inline LockGuarded<std::shared_ptr<Delaunay>>& delaunay();
+    // Labels over the loaded tiles, by priority, as indices into the mapped
+    // labels.
+    struct LabelSet {
+        std::shared_ptr<const Labels> labels;
+        std::vector<unsigned int> indices;
+        // Points of the labels in model coordinates, on the terrain.
+        std::vector<Point> points;
+    };
+
+    // Labels in sight of an eye, among the labels of visibleLabels().
+    struct LabelVisibility {
+        LabelVisibility() :
+            eye(0, 0, 0) {}
+
+        std::shared_ptr<LabelSet> labels;
+        Point eye;
+        std::vector<bool> visible;
+    };
+
+    // Move the eye (Mercator coordinates, elevation of the eye included), and
+    // compute labelVisibility() again in the background.
+    void setEye(const Point& eye);
+
+    inline LockGuardedShared<LabelSet>& visibleLabels();
+    inline LockGuarded<std::shared_ptr<TileDelaunay>>& delaunay();
     inline LockGuardedShared<Mesh>& mesh();
     inline LockGuarded<Point>& origin();
     inline LockGuarded<Point>& selection();
+    inline LockGuardedShared<LabelVisibility>& labelVisibility();
 
     inline LockGuarded<std::function<void()>>& reload();
+    // Called when labelVisibility() changed.
+    inline LockGuarded<std::function<void()>>& visibilityChanged();
 
 private:
     struct Tile {
         TileInfo tileInfo;
-        Polygon points;
+        // Points in Mercator coordinates, and their triangulation.
+        TileDelaunay::Fragment fragment;
+        // Chunk of the last mesh, and the borders it was made with.
+        std::shared_ptr<const Mesh::Chunk> chunk;
+        std::vector<std::vector<TilePoint>> chunkBorders;
     };
 
     // TODO: use proper variant type
@@ -71,7 +120,7 @@ private:
             return m;
         }
 
-        inline static Message make_labels(std::unique_ptr<Labels>&& l, bool valid) {
+        inline static Message make_labels(std::shared_ptr<const Labels>&& l, bool valid) {
             Message m;
             m.type = MSG_LABELS;
             m.valid = valid;
@@ -82,33 +131,63 @@ private:
         Type type;
         bool valid;
         Tile tile;
-        std::unique_ptr<Labels> labels;
+        std::shared_ptr<const Labels> labels;
+    };
+
+    // Inputs of the computation of visibility, and its state.
+    struct VisibilityState {
+        VisibilityState() :
+            eye(0, 0, 0), eyeKnown(false), running(false), dirty(false) {}
+
+        std::shared_ptr<const TileVisibility> engine;
+        std::shared_ptr<LabelSet> labels;
+        // Points of the labels in Mercator coordinates.
+        std::shared_ptr<const std::vector<Point>> targets;
+        Point eye;
+        bool eyeKnown;
+        // A task is computing the visibility, and the inputs changed since
+        // it started.
+        bool running;
+        bool dirty;
     };
 
     static std::vector<TileInfo> genTileList(int x, int y, int zoom);
-    void loadGlobalLabels();
+    void loadLabels(const std::vector<TileInfo>& tiles);
     void load(int zoom, int x, int y, bool retry);
+    // Send a loaded tile, or a failure, to the update loop of loadLatLon().
+    void postTile(Tile&& tile, bool valid);
     void tile2xyz(int zoom, int x, int y, const std::string& content);
+    bool loadFragment(int zoom, int x, int y, TileDelaunay::Fragment& fragment);
+    void storeFragment(int zoom, int x, int y, const TileDelaunay::Fragment& fragment, double tolerance);
+    void updateVisibility();
 
-    static std::shared_ptr<Mesh> makeMesh(const Delaunay& delaunay, const Point& origin);
+    static std::shared_ptr<Mesh> makeMesh(std::vector<Tile>& tiles, const TileDelaunay& delaunay, const Point& origin);
+    static std::shared_ptr<Mesh::Chunk> makeChunk(const Tile& tile, const std::vector<std::vector<TilePoint>>& borders, const Point& origin);
 
     std::shared_ptr<Database> mDatabase;
-    // TODO: use std::optional
-    std::unique_ptr<Labels> mLabels;
+    std::shared_ptr<const Labels> mLabels;
     std::vector<Tile> mTiles;
     LockGuarded<std::vector<Message>> mMsgQueue;
-    LockGuardedShared<std::vector<Label>> mVisibleLabels;
-    LockGuarded<std::shared_ptr<Delaunay>> mDelaunay;
+    LockGuardedShared<LabelSet> mVisibleLabels;
+    LockGuarded<std::shared_ptr<TileDelaunay>> mDelaunay;
+    // Model replaced by the last insertion, and the points it misses, to
+    // insert into instead of copying the current model.
+    std::shared_ptr<TileDelaunay> mSpareDelaunay;
+    std::vector<TilePoint> mSparePoints;
     LockGuardedShared<Mesh> mMesh;
     LockGuarded<Point> mOrigin;
     LockGuarded<Point> mSelection;
 
+    LockGuarded<VisibilityState> mVisibilityState;
+    LockGuardedShared<LabelVisibility> mLabelVisibility;
+
     LockGuarded<std::function<void()>> mReload;
+    LockGuarded<std::function<void()>> mVisibilityChanged;
 };
 
-inline LockGuardedShared<std::vector<Label>>& WorldModel::visibleLabels()
+inline LockGuardedShared<WorldModel::LabelSet>& WorldModel::visibleLabels()
     {return mVisibleLabels;}
-inline LockGuarded<std::shared_ptr<Delaunay>>& WorldModel::delaunay()
+inline LockGuarded<std::shared_ptr<TileDelaunay>>& WorldModel::delaunay()
     {return mDelaunay;}
 inline LockGuardedShared<WorldModel::Mesh>& WorldModel::mesh()
     {return mMesh;}
@@ -116,9 +195,13 @@ inline LockGuarded<Point>& WorldModel::origin()
     {return mOrigin;}
 inline LockGuarded<Point>& WorldModel::selection()
     {return mSelection;}
+inline LockGuardedShared<WorldModel::LabelVisibility>& WorldModel::labelVisibility()
+    {return mLabelVisibility;}
 
 inline LockGuarded<std::function<void()>>& WorldModel::reload()
     {return mReload;}
+inline LockGuarded<std::function<void()>>& WorldModel::visibilityChanged()
+    {return mVisibilityChanged;}
 
 
 #endif // WORLD_MODEL_HPP
@@ -54,11 +54,16 @@ HEADERS += \
     geometry/polygon.hpp \
     geometry/primitives.hpp \
     geometry/quadtree.hpp \
+    geometry/simplifier.hpp \
+    geometry/streamingdelaunay.hpp \
+    geometry/tilepoint.hpp \
     geometry/triangulate.hpp \
+    geometry/visibility.hpp \
     geometry/worldmodel.hpp \
     protobuf/mvt.hpp \
     protobuf/cache_index.pb.h \
     protobuf/labels.pb.h \
+    protobuf/triangulation.pb.h \
     protobuf/vector_tile.pb.h \
     protobuf/xyz.pb.h \
     ui/mainwindow.hpp \
@@ -66,6 +71,8 @@ HEADERS += \
     ui/panorama.hpp \
     util/concurrency.hpp \
     util/gzip.hpp \
+    util/mappedfile.hpp \
+    util/timer.hpp \
 
 SOURCES += \
     main.cpp \
@@ -80,18 +87,24 @@ SOURCES += \
     geometry/polygon.cpp \
     geometry/primitives.cpp \
     geometry/quadtree.cpp \
+    geometry/simplifier.cpp \
+    geometry/streamingdelaunay.cpp \
+    geometry/tilepoint.cpp \
     geometry/triangulate.cpp \
+    geometry/visibility.cpp \
     geometry/worldmodel.cpp \
     protobuf/mvt.cpp \
     protobuf/cache_index.pb.cc \
     protobuf/labels.pb.cc \
+    protobuf/triangulation.pb.cc \
     protobuf/vector_tile.pb.cc \
     protobuf/xyz.pb.cc \
     ui/mainwindow.cpp \
     ui/openglwidget.cpp \
     ui/panorama.cpp \
     util/gzip.cpp \
-    util/concurrency.cpp
+    util/concurrency.cpp \
+    util/mappedfile.cpp
 
 RESOURCES += \
     panoramix.qrc
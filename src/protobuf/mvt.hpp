@@ -23,35 +23,6 @@
 #include "protobuf/vector_tile.pb.h"
 #include "geometry/polygon.hpp"
 
-class Label
-{
-public:
-    enum Type {
-        PEAK, SADDLE, VOLCANO, OTHER
-    };
-
-    Label(const Label& label) = default;
-    Label(Label&& label) = default;
-    Label& operator=(const Label&) = default;
-
-    inline Label(std::string&& _name, Point&& _p, Type _t, bool _hasElevation) :
-        name(std::move(_name)), point(std::move(_p)), elevation(point.z), type(_t), hasElevation(_hasElevation) {}
-
-    inline bool operator==(const Label& l) const
-        {return name == l.name && point == l.point;}
-    inline bool operator<(const Label& l) const
-        {return point == l.point ? name < l.name : Point::lexcomp2(point, l.point);}
-
-    inline double elevationEstimate() const
-        {return hasElevation ? elevation : point.z;}
-
-    std::string name;
-    Point point;
-    double elevation;
-    Type type;
-    bool hasElevation;
-};
-
 class Mvt
 {
 public:
@@ -18,19 +18,143 @@
 
 #include "openglwidget.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstring>
 #include <QWheelEvent>
 #include <QMouseEvent>
 #include <QResource>
 #include <QPainter>
+#include <QImage>
+#include <QFontInfo>
 #include "config.hpp"
 #include "geometry/astro.hpp"
+#include "util/timer.hpp"
+
+// Size in pixels of the cells of the grid of labels on screen.
+static constexpr int LABEL_GRID_CELL = 64;
+
+// Size in pixels of the square atlas of the text of labels.
+static constexpr int LABEL_ATLAS_SIZE = 2048;
+// Square of opaque texels at the origin of the atlas, for callouts.
+static constexpr int LABEL_ATLAS_OPAQUE = 4;
+// Characters of distances, drawn once in the atlas.
+static constexpr char DISTANCE_GLYPHS[] = "0123456789.e+-@ km";
+
+// Floats per vertex of labels: position on screen, position in the atlas, and
+// color premultiplied by its alpha.
+static constexpr int LABEL_VERTEX_SIZE = 8;
+
+static void addLabelVertex(std::vector<GLfloat>& vertices, const QPointF& p, const QPointF& texCoord, const std::array<GLfloat, 4>& color)
+{
+    vertices.insert(vertices.end(), {
+        GLfloat(p.x()), GLfloat(p.y()),
+        GLfloat(texCoord.x() / LABEL_ATLAS_SIZE), GLfloat(texCoord.y() / LABEL_ATLAS_SIZE),
+        color[0], color[1], color[2], color[3]
+    });
+}
+
+// Two triangles covering 'rect' on screen, sampling 'texture' in the atlas.
+static void addLabelQuad(std::vector<GLfloat>& vertices, const QRectF& rect, const QRectF& texture, const std::array<GLfloat, 4>& color)
+{
+    addLabelVertex(vertices, rect.topLeft(), texture.topLeft(), color);
+    addLabelVertex(vertices, rect.bottomLeft(), texture.bottomLeft(), color);
+    addLabelVertex(vertices, rect.topRight(), texture.topRight(), color);
+    addLabelVertex(vertices, rect.topRight(), texture.topRight(), color);
+    addLabelVertex(vertices, rect.bottomLeft(), texture.bottomLeft(), color);
+    addLabelVertex(vertices, rect.bottomRight(), texture.bottomRight(), color);
+}
+
+static std::array<GLfloat, 4> premultiplied(const QColor& color)
+{
+    GLfloat alpha = color.alphaF();
+    return {{GLfloat(color.redF() * alpha), GLfloat(color.greenF() * alpha), GLfloat(color.blueF() * alpha), alpha}};
+}
+
+// Width in the atlas of a line of text, cut at the size of the atlas.
+static int atlasWidth(int width, double ratio)
+{
+    return std::min<int>(std::ceil(width * ratio), LABEL_ATLAS_SIZE - 1);
+}
+
+// Index of a character in DISTANCE_GLYPHS, or -1.
+static int glyphIndex(QChar c)
+{
+    char latin = c.toLatin1();
+    const char* glyph = latin ? std::strchr(DISTANCE_GLYPHS, latin) : nullptr;
+    return glyph ? glyph - DISTANCE_GLYPHS : -1;
+}
+
+static int advance(const QFontMetrics& metrics, const QString& text)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 11, 0)
+    return metrics.horizontalAdvance(text);
+#else
+    return metrics.width(text);
+#endif
+}
+
+// Uniform grid over the screen, with the rectangles that intersect each cell,
+// for collision tests in constant time per rectangle.
+class RectGrid
+{
+public:
+    RectGrid(int w, int h) :
+        mWidth(w / LABEL_GRID_CELL + 1), mHeight(h / LABEL_GRID_CELL + 1), mCells(mWidth * mHeight) {}
+
+    bool contains(const QPoint& p) const
+        {return this->intersects(QRect(p, p));}
+
+    bool intersects(const QRect& rect) const
+    {
+        int x0, y0, x1, y1;
+        this->cellRange(rect, x0, y0, x1, y1);
+        for (int y = y0 ; y <= y1 ; ++y)
+            for (int x = x0 ; x <= x1 ; ++x)
+                for (unsigned int r : mCells[y * mWidth + x])
+                    if (mRects[r].intersects(rect))
+                        return true;
+        return false;
+    }
+
+    void insert(const QRect& rect)
+    {
+        int x0, y0, x1, y1;
+        this->cellRange(rect, x0, y0, x1, y1);
+        for (int y = y0 ; y <= y1 ; ++y)
+            for (int x = x0 ; x <= x1 ; ++x)
+                mCells[y * mWidth + x].push_back(mRects.size());
+        mRects.push_back(rect);
+    }
+
+    unsigned int size() const
+        {return mRects.size();}
+
+private:
+    // Cells that intersect the rectangle, clamped to the screen.
+    void cellRange(const QRect& rect, int& x0, int& y0, int& x1, int& y1) const
+    {
+        x0 = std::min(std::max(rect.left() / LABEL_GRID_CELL, 0), mWidth - 1);
+        y0 = std::min(std::max(rect.top() / LABEL_GRID_CELL, 0), mHeight - 1);
+        x1 = std::min(std::max(rect.right() / LABEL_GRID_CELL, 0), mWidth - 1);
+        y1 = std::min(std::max(rect.bottom() / LABEL_GRID_CELL, 0), mHeight - 1);
+    }
+
+    int mWidth;
+    int mHeight;
+    std::vector<std::vector<unsigned int>> mCells;
+    std::vector<QRect> mRects;
+};
 
 GLWidget::GLWidget(const std::shared_ptr<WorldModel>& worldModel, QWidget* parent) :
     QOpenGLWidget(parent),
-    mBufferVertices(QOpenGLBuffer::VertexBuffer),
-    mBufferNormals(QOpenGLBuffer::VertexBuffer),
-    mBufferIndices(QOpenGLBuffer::IndexBuffer),
+    mFont("Georgia", 15),
+    mMetrics(mFont),
+    mAtlasFont(mFont),
+    mVertexLocation(-1),
+    mNormalLocation(-1),
+    mLodScale(1),
     mPointCount(0),
     mTriangleCount(0),
     mTileCount(0),
@@ -43,8 +167,23 @@ GLWidget::GLWidget(const std::shared_ptr<WorldModel>& worldModel, QWidget* paren
     mRotate(180, 0, 0), // Towards South
     mSunRotate(270), // South
     mZoom(0),
-    mMousePress(false)
+    mMousePress(false),
+    mLabelVertices(QOpenGLBuffer::VertexBuffer),
+    mAtlasTexture(0),
+    mAtlasRatio(0),
+    mAtlasX(0),
+    mAtlasY(0),
+    mAtlasRow(0)
 {
+    mAtlasFont.setPixelSize(QFontInfo(mFont).pixelSize());
+    for (const char* c = DISTANCE_GLYPHS ; *c ; ++c)
+    {
+        AtlasLine glyph;
+        glyph.text = QChar(*c);
+        glyph.width = advance(mMetrics, glyph.text);
+        mGlyphs.push_back(glyph);
+    }
+
     this->setMinimumSize(200, 200);
     this->setCursor(Qt::OpenHandCursor);
     this->setFocusPolicy(Qt::StrongFocus);
@@ -65,27 +204,37 @@ void GLWidget::reload()
     }
 
     mPointCount = mesh->pointCount;
-    mTriangleCount = mesh->triangleCount;
-    auto& vertices = mesh->vertices;
-    auto& normals = mesh->normals;
-    auto& indices = mesh->indices;
     mTileCount = mesh->tileCount;
     mLabelCount = mesh->labelCount;
 
     std::cerr << "GLWidget::reload() with " << mPointCount << " points" << std::endl;
 
-    // Update VBOs
-    mBufferVertices.bind();
-    mBufferVertices.allocate(vertices.data(), sizeof(GLfloat)*vertices.size());
-    mBufferVertices.release();
-
-    mBufferNormals.bind();
-    mBufferNormals.allocate(normals.data(), sizeof(GLfloat)*normals.size());
-    mBufferNormals.release();
-
-    mBufferIndices.bind();
-    mBufferIndices.allocate(indices.data(), sizeof(GLuint)*indices.size());
-    mBufferIndices.release();
+    mChunks = std::move(mesh->chunks);
+
+    // Drop the chunks of tiles that are no longer in the mesh.
+    this->makeCurrent();
+    auto removed = [this](const std::unique_ptr<GpuChunk>& gpu) {
+        return std::none_of(mChunks.begin(), mChunks.end(), [&gpu](const std::shared_ptr<const WorldModel::Mesh::Chunk>& chunk) {
+            return chunk->tileInfo == gpu->chunk->tileInfo;
+        });
+    };
+    mGpuChunks.erase(std::remove_if(mGpuChunks.begin(), mGpuChunks.end(), removed), mGpuChunks.end());
+    this->doneCurrent();
+
+    // Only new chunks are uploaded, nearest first, during the next frames.
+    mPendingChunks.clear();
+    for (auto& chunk : mChunks)
+    {
+        bool uploaded = std::any_of(mGpuChunks.begin(), mGpuChunks.end(), [&chunk](const std::unique_ptr<GpuChunk>& gpu) {
+            return gpu->chunk == chunk;
+        });
+        if (!uploaded)
+            mPendingChunks.push_back(chunk);
+    }
+    std::sort(mPendingChunks.begin(), mPendingChunks.end(),
+              [this](const std::shared_ptr<const WorldModel::Mesh::Chunk>& lhs, const std::shared_ptr<const WorldModel::Mesh::Chunk>& rhs) {
+        return (lhs->center - mEyeModel).dist3() < (rhs->center - mEyeModel).dist3();
+    });
 
     std::cerr << "GLWidget::reload() finished" << std::endl;
 }
@@ -118,51 +267,104 @@ void GLWidget::initializeGL()
     mProgram.link();
     std::cerr << "Shader linking output: " << mProgram.log().toStdString() << std::endl;
 
-    // Vertex buffer objects
-    mBufferVertices.create();
-    mBufferVertices.bind();
-    mBufferVertices.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    mBufferVertices.allocate(nullptr, 0);
-    mBufferVertices.release();
-
-    mBufferNormals.create();
-    mBufferNormals.bind();
-    mBufferNormals.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    mBufferNormals.allocate(nullptr, 0);
-    mBufferNormals.release();
-
-    mBufferIndices.create();
-    mBufferIndices.bind();
-    mBufferIndices.setUsagePattern(QOpenGLBuffer::StaticDraw);
-    mBufferIndices.allocate(nullptr, 0);
-    mBufferIndices.release();
-
-    // Vertex array object
+    // Vertex array object, with the buffers of each chunk bound when drawing.
     mVAO.create();
     mProgram.bind();
 
-    int vertexLocation = mProgram.attributeLocation("vertex");
-    int normalLocation = mProgram.attributeLocation("normal");
+    mVertexLocation = mProgram.attributeLocation("vertex");
+    mNormalLocation = mProgram.attributeLocation("normal");
 
     mVAO.bind();
-        mBufferVertices.bind();
-        mProgram.enableAttributeArray(vertexLocation);
-#ifdef USE_EARTH_CURVATURE
-        mProgram.setAttributeBuffer(vertexLocation, GL_FLOAT, 0, 4);
-#else
-        mProgram.setAttributeBuffer(vertexLocation, GL_FLOAT, 0, 3);
-#endif
-        mBufferVertices.release();
-
-        mBufferNormals.bind();
-        mProgram.enableAttributeArray(normalLocation);
-        mProgram.setAttributeBuffer(normalLocation, GL_FLOAT, 0, 3);
-        mBufferNormals.release();
+        mProgram.enableAttributeArray(mVertexLocation);
+        mProgram.enableAttributeArray(mNormalLocation);
     mVAO.release();
 
-    mProgram.disableAttributeArray(vertexLocation);
-    mProgram.disableAttributeArray(normalLocation);
+
+    mProgram.disableAttributeArray(mVertexLocation);
+    mProgram.disableAttributeArray(mNormalLocation);
     mProgram.release();
+
+    // Labels, with a single vertex buffer filled every frame.
+    mLabelProgram.addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shaders/label.vert");
+    mLabelProgram.addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shaders/label.frag");
+    mLabelProgram.link();
+    std::cerr << "Label shader linking output: " << mLabelProgram.log().toStdString() << std::endl;
+
+    mLabelVertices.create();
+    mLabelVertices.setUsagePattern(QOpenGLBuffer::StreamDraw);
+    mLabelVAO.create();
+    mLabelProgram.bind();
+    mLabelVAO.bind();
+    mLabelVertices.bind();
+        int stride = LABEL_VERTEX_SIZE * sizeof(GLfloat);
+        int location = mLabelProgram.attributeLocation("vertex");
+        mLabelProgram.enableAttributeArray(location);
+        mLabelProgram.setAttributeBuffer(location, GL_FLOAT, 0, 2, stride);
+        location = mLabelProgram.attributeLocation("texCoord");
+        mLabelProgram.enableAttributeArray(location);
+        mLabelProgram.setAttributeBuffer(location, GL_FLOAT, 2 * sizeof(GLfloat), 2, stride);
+        location = mLabelProgram.attributeLocation("color");
+        mLabelProgram.enableAttributeArray(location);
+        mLabelProgram.setAttributeBuffer(location, GL_FLOAT, 4 * sizeof(GLfloat), 4, stride);
+    mLabelVAO.release();
+    mLabelVertices.release();
+    mLabelProgram.release();
+
+    // Coverage of text, drawn in the atlas by resetAtlas() and rasterize().
+    glGenTextures(1, &mAtlasTexture);
+    glBindTexture(GL_TEXTURE_2D, mAtlasTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, LABEL_ATLAS_SIZE, LABEL_ATLAS_SIZE, 0, GL_ALPHA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GLWidget::uploadChunks()
+{
+    Timer timer;
+    while (!mPendingChunks.empty())
+    {
+        std::unique_ptr<GpuChunk> gpu = std::make_unique<GpuChunk>();
+        gpu->chunk = std::move(mPendingChunks.front());
+        mPendingChunks.pop_front();
+        const WorldModel::Mesh::Chunk& chunk = *gpu->chunk;
+
+        gpu->vertices.create();
+        gpu->vertices.bind();
+        gpu->vertices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        gpu->vertices.allocate(chunk.vertices.data(), sizeof(GLfloat)*chunk.vertices.size());
+        gpu->vertices.release();
+
+        gpu->normals.create();
+        gpu->normals.bind();
+        gpu->normals.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        gpu->normals.allocate(chunk.normals.data(), sizeof(GLfloat)*chunk.normals.size());
+        gpu->normals.release();
+
+        gpu->indices.create();
+        gpu->indices.bind();
+        gpu->indices.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        gpu->indices.allocate(chunk.indices.data(), sizeof(GLuint)*chunk.indices.size());
+        gpu->indices.release();
+
+        // Replace the chunk of the same tile from a previous mesh.
+        auto it = std::find_if(mGpuChunks.begin(), mGpuChunks.end(), [&chunk](const std::unique_ptr<GpuChunk>& other) {
+            return other->chunk->tileInfo == chunk.tileInfo;
+        });
+        if (it != mGpuChunks.end())
+            *it = std::move(gpu);
+        else
+            mGpuChunks.push_back(std::move(gpu));
+
+        if (timer.elapsed() >= MESH_UPLOAD_BUDGET)
+            break;
+    }
+
+    // Continue in the next frame.
+    if (!mPendingChunks.empty())
+        this->update();
 }
 
 void GLWidget::paintGL()
@@ -181,6 +383,7 @@ void GLWidget::paintGL()
     glCullFace(GL_BACK);
 
     this->loadModelView();
+    this->uploadChunks();
 
     QMatrix4x4 pmvMatrix = mProjection * mModelView;
 
@@ -195,36 +398,52 @@ void GLWidget::paintGL()
     mProgram.setUniformValue(matrixLocation, pmvMatrix);
     mProgram.setUniformValue(lightLocation, light.x, light.y, light.z, 0);
     mVAO.bind();
-    mBufferIndices.bind();
 
-    glDrawElements(GL_TRIANGLES, 3*mTriangleCount, GL_UNSIGNED_INT, nullptr);
+    // Each chunk at its level of detail.
+    mTriangleCount = 0;
+    for (auto& gpu : mGpuChunks)
+    {
+        const WorldModel::Mesh::Chunk& chunk = *gpu->chunk;
+        if (chunk.levels.empty())
+            continue;
+        auto& range = chunk.levels[this->chunkLevel(chunk)];
+        if (!range.second)
+            continue;
+
+        gpu->vertices.bind();
+#ifdef USE_EARTH_CURVATURE
+        mProgram.setAttributeBuffer(mVertexLocation, GL_FLOAT, 0, 4);
+#else
+        mProgram.setAttributeBuffer(mVertexLocation, GL_FLOAT, 0, 3);
+#endif
+        gpu->normals.bind();
+        mProgram.setAttributeBuffer(mNormalLocation, GL_FLOAT, 0, 3);
+        gpu->indices.bind();
+
+        glDrawElements(GL_TRIANGLES, range.second, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(GLuint) * range.first));
+        mTriangleCount += range.second / 3;
+    }
 
-    mBufferIndices.release();
     mVAO.release();
+    QOpenGLBuffer::release(QOpenGLBuffer::VertexBuffer);
     mProgram.release();
 
-    // Read depth buffer
     int w = width();
     int h = height();
-    int w_pixels = RETINA_FACTOR*w;
-    int h_pixels = RETINA_FACTOR*h;
-    mDepthBuffer.resize(w_pixels*h_pixels);
-    glReadPixels(0, 0, w_pixels, h_pixels, GL_DEPTH_COMPONENT, GL_FLOAT, mDepthBuffer.data());
+    double ratio = this->devicePixelRatioF();
 
 
     /** 2D graphics **/
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
-    painter.endNativePainting();
 
-    QFont font("Georgia", 15);
-    QFontMetrics metrics(font);
+    // Labels
+    this->drawLabels(pmvMatrix, w, h);
 
-    painter.setFont(font);
-    painter.setPen(Qt::black);
+    painter.endNativePainting();
 
-    // Labels
-    this->drawLabels(painter, pmvMatrix, metrics, w, h, w_pixels, h_pixels);
+    painter.setFont(mFont);
+    painter.setPen(Qt::black);
 
     // Status bar
     Point selection = mWorldModel->selection().get();
@@ -243,126 +462,349 @@ void GLWidget::paintGL()
             + " | " + QString::number(mTriangleCount) + " triangles"
     ;
 
-    int ypadding = 1*RETINA_FACTOR;
-    int yrect = h - ypadding - 2*metrics.height();
+    int ypadding = std::lround(1*ratio);
+    int yrect = h - ypadding - 2*mMetrics.height();
     painter.fillRect(0, yrect, w, h - yrect, QColor(0xFF, 0xFF, 0xFF, 0xC0));
     painter.drawLine(0, yrect, w, yrect);
-    int ytext = yrect + metrics.height() - metrics.descent();
+    int ytext = yrect + mMetrics.height() - mMetrics.descent();
     painter.drawText(0, ytext, status);
-    painter.drawText(0, ytext + metrics.height(), statistics);
+    painter.drawText(0, ytext + mMetrics.height(), statistics);
 
-    painter.drawText(0, yrect, w, metrics.height(), Qt::AlignRight, QString::fromUtf8("Data \xC2\xA9 Mapbox \xC2\xA9 OpenStreetMap"));
+    painter.drawText(0, yrect, w, mMetrics.height(), Qt::AlignRight, QString::fromUtf8("Data \xC2\xA9 Mapbox \xC2\xA9 OpenStreetMap"));
 }
 
-void GLWidget::drawLabels(QPainter& painter, const QMatrix4x4& pmvMatrix, const QFontMetrics& metrics, int w, int h, int w_pixels, int h_pixels)
+void GLWidget::drawLabels(const QMatrix4x4& pmvMatrix, int w, int h)
 {
-    std::vector<QRect> acceptedLabels;
+    double ratio = this->devicePixelRatioF();
+    int xpadding = std::lround(2*ratio);
+    int ypadding = std::lround(1*ratio);
+    int triangleSize = std::lround(5*ratio);
+    int xmargin = std::lround(5*ratio);
+    int ymargin = std::lround(8*ratio);
+
+    // Labels in sight of the last eye that the WorldModel processed.
+    std::shared_ptr<WorldModel::LabelVisibility> visibility = mWorldModel->labelVisibility().get();
+    if (!visibility->labels)
+        return;
+    const WorldModel::LabelSet& labels = *visibility->labels;
+    if (mTextLabels != visibility->labels)
+    {
+        mTextLabels = visibility->labels;
+        mLabelTexts.clear();
+        mLabelTexts.resize(labels.indices.size());
+        mAtlasRatio = 0;
+    }
+    if (mAtlasRatio != ratio)
+        this->resetAtlas(ratio);
+
+    std::vector<unsigned int> indices;
+    for (unsigned int i = 0 ; i < labels.indices.size() ; ++i)
+        if (visibility->visible[i])
+            indices.push_back(i);
+
+    // Project all anchors at once, in a loop that the compiler vectorizes.
+    unsigned int n = indices.size();
+    std::vector<float> xs(n), ys(n), zs(n);
+    for (unsigned int k = 0 ; k < n ; ++k)
+    {
+        const Point& p = labels.points[indices[k]];
+        xs[k] = p.x;
+        ys[k] = p.y;
+        zs[k] = p.z;
+    }
+    const float* m = pmvMatrix.constData();
+    for (unsigned int k = 0 ; k < n ; ++k)
+    {
+        float x = xs[k];
+        float y = ys[k];
+        float z = zs[k];
+        float iw = 1.0f / (m[3]*x + m[7]*y + m[11]*z + m[15]);
+        xs[k] = (m[0]*x + m[4]*y + m[8]*z + m[12]) * iw;
+        ys[k] = (m[1]*x + m[5]*y + m[9]*z + m[13]) * iw;
+        zs[k] = (m[2]*x + m[6]*y + m[10]*z + m[14]) * iw;
+    }
 
-    std::shared_ptr<std::vector<Label>> labels = mWorldModel->visibleLabels().get();
-    for (auto&& l : *labels)
+    // Labels by priority, unless they collide with previous ones.
+    struct Placement {
+        QRect rect;
+        QPoint anchor;
+        Labels::Type type;
+        LabelText* text;
+    };
+    std::vector<Placement> placements;
+    RectGrid acceptedLabels(w, h);
+    unsigned int candidates = 0;
+    for (unsigned int k = 0 ; k < n ; ++k)
     {
-        // Find point on screen
-        QVector3D proj = pmvMatrix.map(QVector3D(l.point.x, l.point.y, l.point.z));
-        if (proj.x() < -1.0 || proj.x() > 1.0 || proj.y() < -1.0 || proj.y() >= 1.0)
+        // Point on screen (and not NaN)
+        if (!(xs[k] >= -1.0 && xs[k] <= 1.0 && ys[k] >= -1.0 && ys[k] < 1.0 && zs[k] <= 1.0))
             continue;
-        int x = (0.5 + 0.5*proj.x()) * w;
-        int y = (0.5 - 0.5*proj.y()) * h;
+        int x = (0.5 + 0.5*xs[k]) * w;
+        int y = (0.5 - 0.5*ys[k]) * h;
 
-        // Find depth test, PEAKS_DEPTH_HEIGHT meters above peak ground
-        QVector3D projDepth = pmvMatrix.map(QVector3D(l.point.x, l.point.y, l.point.z + PEAKS_DEPTH_HEIGHT));
-        if (projDepth.x() < -1.0 || projDepth.x() > 1.0 || projDepth.y() < -1.0)
+        // The bounds of a label contain its anchor, so that labels whose
+        // anchor is covered are rejected before laying out their text.
+        if (acceptedLabels.contains(QPoint(x, y)))
             continue;
-        int xdepth = (0.5 + 0.5*projDepth.x()) * w_pixels;
+        if (candidates == MAX_LABEL_CANDIDATES)
+            break;
+        ++candidates;
+
+        // Compute bounding rectangle
+        LabelText& text = this->labelText(labels, indices[k]);
+        int lines = text.elevation.text.isEmpty() ? 2 : 3;
+        QRect rect(0, 0, text.width + 2*xpadding, lines*mMetrics.height() + 2*ypadding);
+        rect.moveLeft(x - rect.width()/2);
+        rect.moveBottom(y - triangleSize);
+
+        // Check for collision with other labels
+        QRect boundRect(rect.x() - xmargin, rect.y() - ymargin, rect.width() + 2*xmargin, rect.height() + triangleSize + 2*ymargin);
+        if (acceptedLabels.intersects(boundRect))
+            continue;
+        acceptedLabels.insert(boundRect);
+        placements.push_back({rect, QPoint(x, y), labels.labels->record(labels.indices[indices[k]]).type, &text});
 
-        // Adjust to screen
-        int ydepth = projDepth.y() <= 1.0
-                ? (0.5 + 0.5*projDepth.y()) * h_pixels
-                : h_pixels;
-        int y_pixels = (0.5 + 0.5*proj.y()) * h_pixels;
-        if (ydepth >= h_pixels && y_pixels < h_pixels)
-            ydepth = h_pixels - 1;
+        // Limit number of labels on screen
+#ifdef MAX_LABELS_IN_VIEW
+        if (acceptedLabels.size() == MAX_LABELS_IN_VIEW)
+            break;
+#endif
+    }
 
-        if (xdepth < 0 || xdepth >= w_pixels || ydepth < 0 || ydepth >= h_pixels)
-            continue;
+    if (placements.empty())
+        return;
 
-        // Read depth buffer and convert back to [-1, 1] range for OpenGL consistency
-        float depth = mDepthBuffer[xdepth + ydepth*w_pixels];
-        depth = 2*depth - 1;
+    // Draw the new lines of text in the atlas.  If it is full, it is cleared
+    // once for the lines of this frame.
+    auto rasterizeAll = [this, &placements]() {
+        for (auto& placement : placements)
+            for (AtlasLine* line : {&placement.text->name, &placement.text->elevation})
+                if (line->x < 0 && !line->text.isEmpty() && !this->rasterize(*line))
+                    return false;
+        return true;
+    };
+    if (!rasterizeAll())
+    {
+        this->resetAtlas(ratio);
+        if (!rasterizeAll())
+            std::cerr << "Atlas of labels is full" << std::endl;
+    }
 
-        if (projDepth.z() <= 1.0 && projDepth.z() <= depth)
+    std::array<GLfloat, 4> fills[Labels::OTHER + 1];
+    for (int type = 0 ; type <= Labels::OTHER ; ++type)
+    {
+        QColor fill;
+        switch (type) {
+        case Labels::PEAK:
+            fill = QColor(0xFF, 0xFF, 0xC0, 0xC0); break;
+        case Labels::SADDLE:
+            fill = QColor(0xD0, 0xD0, 0xFF, 0xC0); break;
+        case Labels::VOLCANO:
+            fill = QColor(0xFF, 0xC0, 0xC0, 0xC0); break;
+        default:
+            fill = QColor(0xFF, 0xFF, 0xFF, 0xC0); break;
+        }
+        fills[type] = premultiplied(fill);
+    }
+    std::array<GLfloat, 4> black = premultiplied(Qt::black);
+    QRectF opaque(LABEL_ATLAS_OPAQUE / 2, LABEL_ATLAS_OPAQUE / 2, 0, 0);
+
+    // Callouts: a rectangle and a triangle towards the anchor, filled, then
+    // outlined.
+    std::vector<GLfloat> triangles;
+    std::vector<GLfloat> outlines;
+    for (auto& placement : placements)
+    {
+        QRectF rect(QPointF(placement.rect.topLeft()), QPointF(placement.rect.bottomRight()));
+        const std::array<GLfloat, 4>& fill = fills[placement.type];
+        QPointF anchor(placement.anchor);
+        QPointF left(anchor.x() - triangleSize, rect.bottom());
+        QPointF right(anchor.x() + triangleSize, rect.bottom());
+
+        addLabelQuad(triangles, rect, opaque, fill);
+        for (const QPointF& p : {left, anchor, right})
+            addLabelVertex(triangles, p, opaque.topLeft(), fill);
+
+        // Lines through the centers of pixels.
+        QPointF path[] = {rect.topLeft(), rect.bottomLeft(), left, anchor, right, rect.bottomRight(), rect.topRight(), rect.topLeft()};
+        for (unsigned int i = 0 ; i + 1 < sizeof(path) / sizeof(path[0]) ; ++i)
+            for (const QPointF& p : {path[i], path[i + 1]})
+                addLabelVertex(outlines, p + QPointF(0.5, 0.5), opaque.topLeft(), black);
+    }
+
+    // Lines of text, centered in their rectangle, over all callouts.
+    int atlasHeight = mAtlasRow - 1;
+    auto addLine = [&triangles, &black, ratio, atlasHeight](const AtlasLine& line, int x, int y) {
+        if (line.x < 0)
+            return;
+        int width = atlasWidth(line.width, ratio);
+        addLabelQuad(triangles, QRectF(x, y, width / ratio, atlasHeight / ratio), QRectF(line.x, line.y, width, atlasHeight), black);
+    };
+    for (auto& placement : placements)
+    {
+        const LabelText& text = *placement.text;
+        int x = placement.anchor.x();
+        int y = placement.rect.top() + ypadding;
+
+        addLine(text.name, x - text.name.width / 2, y);
+        y += mMetrics.height();
+        if (!text.elevation.text.isEmpty())
+        {
+            addLine(text.elevation, x - text.elevation.width / 2, y);
+            y += mMetrics.height();
+        }
+        x -= text.distanceWidth / 2;
+        for (QChar c : text.distance)
         {
-            // Compute bounding rectangle
-            QString name = QString::fromUtf8(l.name.c_str());
-            if (l.hasElevation)
-                name += "\n" + QString::number(l.elevation) + " m";
-            double distance = std::round(std::sqrt((l.point - mEyeModel).dist2()) / 100.0) / 10.0;
-            name += "\n@ " + QString::number(distance) + " km";
-
-            QRect rect = metrics.boundingRect(QRect(0, 0, w, h), Qt::AlignCenter, name);
-            int xpadding = 2*RETINA_FACTOR;
-            int ypadding = 1*RETINA_FACTOR;
-            int triangleSize = 5*RETINA_FACTOR;
-            int xmargin = 5*RETINA_FACTOR;
-            int ymargin = 8*RETINA_FACTOR;
-            rect.setWidth(rect.width() + 2*xpadding);
-            rect.setHeight(rect.height() + 2*ypadding);
-            rect.moveLeft(x - rect.width()/2);
-            rect.moveBottom(y - triangleSize);
-
-            // Check for collision with other labels
-            QRect boundRect(rect.x() - xmargin, rect.y() - ymargin, rect.width() + 2*xmargin, rect.height() + triangleSize + 2*ymargin);
-            bool accepted = true;
-            for (auto& r : acceptedLabels)
-            {
-                if (boundRect.intersects(r))
-                {
-                    accepted = false;
-                    break;
-                }
-            }
-            if (!accepted)
+            int g = glyphIndex(c);
+            if (g < 0)
                 continue;
-            acceptedLabels.push_back(boundRect);
-
-            // Draw label
-            QPainterPath path;
-            path.moveTo(rect.topLeft());
-            path.lineTo(rect.bottomLeft());
-            path.lineTo(x-triangleSize, rect.bottom());
-            path.lineTo(x, y);
-            path.lineTo(x+triangleSize, rect.bottom());
-            path.lineTo(rect.bottomRight());
-            path.lineTo(rect.topRight());
-            path.lineTo(rect.topLeft());
-
-            QColor fill;
-            switch (l.type) {
-            case Label::PEAK:
-                fill = QColor(0xFF, 0xFF, 0xC0, 0xC0); break;
-            case Label::SADDLE:
-                fill = QColor(0xD0, 0xD0, 0xFF, 0xC0); break;
-            case Label::VOLCANO:
-                fill = QColor(0xFF, 0xC0, 0xC0, 0xC0); break;
-            default:
-                fill = QColor(0xFF, 0xFF, 0xFF, 0xC0); break;
-            }
-            painter.fillPath(path, fill);
-            painter.drawPath(path);
-
-            painter.drawText(rect, Qt::AlignCenter, name);
-
-            // Limit number of labels on screen
-#ifdef MAX_LABELS_IN_VIEW
-            if (acceptedLabels.size() == MAX_LABELS_IN_VIEW)
-                break;
-#endif
+            addLine(mGlyphs[g], x, y);
+            x += mGlyphs[g].width;
+        }
+    }
+
+    // One buffer, drawn in two calls.
+    int triangleVertices = triangles.size() / LABEL_VERTEX_SIZE;
+    int outlineVertices = outlines.size() / LABEL_VERTEX_SIZE;
+    triangles.insert(triangles.end(), outlines.begin(), outlines.end());
+    mLabelVertices.bind();
+    mLabelVertices.allocate(triangles.data(), sizeof(GLfloat) * triangles.size());
+    mLabelVertices.release();
+
+    QMatrix4x4 screen;
+    screen.ortho(0, w, h, 0, -1, 1);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, mAtlasTexture);
+    mLabelProgram.bind();
+    mLabelProgram.setUniformValue(mLabelProgram.uniformLocation("matrix"), screen);
+    mLabelProgram.setUniformValue(mLabelProgram.uniformLocation("atlas"), 0);
+    mLabelVAO.bind();
+
+    glDrawArrays(GL_TRIANGLES, 0, triangleVertices);
+    glDrawArrays(GL_LINES, triangleVertices, outlineVertices);
+
+    mLabelVAO.release();
+    mLabelProgram.release();
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_BLEND);
+}
+
+void GLWidget::resetAtlas(double ratio)
+{
+    mAtlasRatio = ratio;
+    mAtlasX = 0;
+    mAtlasY = 0;
+    // Rows are one pixel apart, so that filtering does not mix lines.
+    mAtlasRow = std::ceil(mMetrics.height() * ratio) + 1;
+    for (auto& text : mLabelTexts)
+    {
+        if (!text)
+            continue;
+        text->name.x = -1;
+        text->elevation.x = -1;
+    }
+
+    std::vector<GLubyte> opaque(LABEL_ATLAS_OPAQUE * LABEL_ATLAS_OPAQUE, 0xFF);
+    this->uploadAtlas(0, 0, LABEL_ATLAS_OPAQUE, LABEL_ATLAS_OPAQUE, opaque.data());
+    mAtlasX = LABEL_ATLAS_OPAQUE + 1;
+
+    for (AtlasLine& glyph : mGlyphs)
+        this->rasterize(glyph);
+}
+
+bool GLWidget::rasterize(AtlasLine& line)
+{
+    // Nothing to draw.
+    int w = atlasWidth(line.width, mAtlasRatio);
+    int h = mAtlasRow - 1;
+    if (w <= 0)
+        return true;
+
+    if (mAtlasX + w > LABEL_ATLAS_SIZE)
+    {
+        mAtlasX = 0;
+        mAtlasY += mAtlasRow;
+    }
+    if (mAtlasY + h > LABEL_ATLAS_SIZE)
+        return false;
+
+    QImage image(w, h, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    image.setDevicePixelRatio(mAtlasRatio);
+    QPainter painter(&image);
+    painter.setFont(mAtlasFont);
+    painter.setPen(Qt::black);
+    painter.drawText(0, mMetrics.ascent(), line.text);
+    painter.end();
+
+    std::vector<GLubyte> coverage(w * h);
+    for (int y = 0 ; y < h ; ++y)
+    {
+        const QRgb* row = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+        for (int x = 0 ; x < w ; ++x)
+            coverage[y * w + x] = qAlpha(row[x]);
+    }
+    this->uploadAtlas(mAtlasX, mAtlasY, w, h, coverage.data());
+
+    line.x = mAtlasX;
+    line.y = mAtlasY;
+    mAtlasX += w + 1;
+    return true;
+}
+
+void GLWidget::uploadAtlas(int x, int y, int w, int h, const GLubyte* coverage)
+{
+    glBindTexture(GL_TEXTURE_2D, mAtlasTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_ALPHA, GL_UNSIGNED_BYTE, coverage);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+GLWidget::LabelText& GLWidget::labelText(const WorldModel::LabelSet& labels, unsigned int i)
+{
+    unsigned int index = labels.indices[i];
+    std::unique_ptr<LabelText>& text = mLabelTexts[i];
+    if (!text)
+    {
+        const Labels::Record& record = labels.labels->record(index);
+        text = std::make_unique<LabelText>();
+        text->name.text = QString::fromUtf8(labels.labels->name(index));
+        text->name.width = advance(mMetrics, text->name.text);
+        if (record.hasElevation)
+        {
+            text->elevation.text = QString::number(record.elevation) + " m";
+            text->elevation.width = advance(mMetrics, text->elevation.text);
         }
+        text->distance100m = -1;
     }
+
+    long distance100m = std::lround(std::sqrt((labels.points[i] - mEyeModel).dist2()) / 100.0);
+    if (distance100m != text->distance100m)
+    {
+        text->distance100m = distance100m;
+        text->distance = "@ " + QString::number(distance100m / 10.0) + " km";
+        text->distanceWidth = 0;
+        for (QChar c : text->distance)
+        {
+            int g = glyphIndex(c);
+            if (g >= 0)
+                text->distanceWidth += mGlyphs[g].width;
+        }
+
+        text->width = std::max({text->name.width, text->elevation.width, text->distanceWidth});
+    }
+    return *text;
 }
 
 void GLWidget::resizeGL(int width, int height)
 {
-    glViewport(0, 0, RETINA_FACTOR*width, RETINA_FACTOR*height);
+    double ratio = this->devicePixelRatioF();
+    glViewport(0, 0, std::lround(ratio*width), std::lround(ratio*height));
 
     this->loadProjection();
 }
@@ -395,10 +837,26 @@ void GLWidget::loadProjection()
     double scaleFactor = 0.0005 * std::pow(2, -mZoom / 4.0) * near;
     double w = scaleFactor * width();
     double h = scaleFactor * height();
+    mLodScale = this->devicePixelRatioF() * near / (2.0 * scaleFactor);
     mProjection.setToIdentity();
     mProjection.frustum(-w, w, -h, h, near, far);
 }
 
+unsigned int GLWidget::chunkLevel(const WorldModel::Mesh::Chunk& chunk) const
+{
+    // Coarsest level whose error is at most MESH_LOD_PIXELS on screen, at
+    // the closest point of the bounding sphere.
+    double distance = std::max(std::sqrt((chunk.center - mEyeModel).dist3()) - chunk.radius, 1.0);
+    double error = MESH_MAX_ERROR * MESH_LOD_RATIO;
+    unsigned int level = 0;
+    while (level + 1 < chunk.levels.size() && error * mLodScale / distance <= MESH_LOD_PIXELS)
+    {
+        ++level;
+        error *= MESH_LOD_RATIO;
+    }
+    return level;
+}
+
 
 void GLWidget::wheelEvent(QWheelEvent* event)
 {
@@ -553,4 +1011,5 @@ void GLWidget::computeEye(const Point& tmp)
         mEyeMercator = newSelection;
 
     mWorldModel->selection().set(std::move(newSelection));
+    mWorldModel->setEye(mEyeMercator + Point(0, 0, VIEWER_HEIGHT));
 }
@@ -24,6 +24,9 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
 #include <QOpenGLVertexArrayObject>
+#include <QFont>
+#include <QFontMetrics>
+#include <deque>
 #include "geometry/worldmodel.hpp"
 #include "util/concurrency.hpp"
 
@@ -48,18 +51,48 @@ private:
     void keyPressEvent(QKeyEvent* event) override;
 
     void computeEye(const Point& tmp);
-    void drawLabels(QPainter& painter, const QMatrix4x4& pmvMatrix, const QFontMetrics& metrics, int w, int h, int w_pixels, int h_pixels);
+    struct AtlasLine;
+    struct LabelText;
+    LabelText& labelText(const WorldModel::LabelSet& labels, unsigned int i);
+    void drawLabels(const QMatrix4x4& pmvMatrix, int w, int h);
+    void resetAtlas(double ratio);
+    bool rasterize(AtlasLine& line);
+    void uploadAtlas(int x, int y, int w, int h, const GLubyte* coverage);
     void loadModelView();
     void loadProjection();
+    void uploadChunks();
+    unsigned int chunkLevel(const WorldModel::Mesh::Chunk& chunk) const;
 
+    QFont mFont;
+    QFontMetrics mMetrics;
+    // Same as mFont, in pixels, to draw in the atlas of labels.
+    QFont mAtlasFont;
     QOpenGLShaderProgram mProgram;
     QMatrix4x4 mProjection;
     QMatrix4x4 mModelView;
-    // Vertex buffers for OpenGL
-    QOpenGLBuffer mBufferVertices;
-    QOpenGLBuffer mBufferNormals;
-    QOpenGLBuffer mBufferIndices;
+    // Vertex buffers for OpenGL, for each chunk of the mesh.
+    struct GpuChunk {
+        GpuChunk() :
+            vertices(QOpenGLBuffer::VertexBuffer),
+            normals(QOpenGLBuffer::VertexBuffer),
+            indices(QOpenGLBuffer::IndexBuffer) {}
+
+        std::shared_ptr<const WorldModel::Mesh::Chunk> chunk;
+        QOpenGLBuffer vertices;
+        QOpenGLBuffer normals;
+        QOpenGLBuffer indices;
+    };
     QOpenGLVertexArrayObject mVAO;
+    int mVertexLocation;
+    int mNormalLocation;
+    // Chunks on the GPU, which may belong to a previous mesh until their
+    // replacement is uploaded.
+    std::vector<std::unique_ptr<GpuChunk>> mGpuChunks;
+    // Chunks of the last mesh, and those waiting for upload.
+    std::vector<std::shared_ptr<const WorldModel::Mesh::Chunk>> mChunks;
+    std::deque<std::shared_ptr<const WorldModel::Mesh::Chunk>> mPendingChunks;
+    // Pixels on screen per meter at a distance of one meter.
+    double mLodScale;
     unsigned int mPointCount;
     unsigned int mTriangleCount;
     unsigned int mTileCount;
@@ -76,7 +109,45 @@ private:
     bool mMousePress;
     QPoint mMousePos;
 
-    std::vector<GLfloat> mDepthBuffer;
+    // Labels are drawn in two batches: the triangles of callouts and of text,
+    // then the lines of outlines.  Text is sampled from an atlas texture of
+    // coverage, where lines of text are drawn once, in rows of the same
+    // height.
+    struct AtlasLine {
+        QString text;
+        // Width on screen.
+        int width = 0;
+        // Position in the atlas, or x < 0 if not drawn there since the last
+        // reset.
+        int x = -1;
+        int y = 0;
+    };
+    QOpenGLShaderProgram mLabelProgram;
+    QOpenGLVertexArrayObject mLabelVAO;
+    QOpenGLBuffer mLabelVertices;
+    GLuint mAtlasTexture;
+    // Device pixel ratio of the atlas, next free position, and height of its
+    // rows.
+    double mAtlasRatio;
+    int mAtlasX;
+    int mAtlasY;
+    int mAtlasRow;
+    // Glyphs of distances, which change whenever the eye moves.
+    std::vector<AtlasLine> mGlyphs;
+
+    // Lines of text of labels, laid out once for the labels of mTextLabels.
+    // Only the distance is laid out again, when it changes, from mGlyphs.
+    struct LabelText {
+        AtlasLine name;
+        AtlasLine elevation;
+        QString distance;
+        int distanceWidth;
+        // Distance shown, in hundreds of meters.
+        long distance100m;
+        int width;
+    };
+    std::shared_ptr<WorldModel::LabelSet> mTextLabels;
+    std::vector<std::unique_ptr<LabelText>> mLabelTexts;
 };
 
 #endif // GLWIDGET_HPP
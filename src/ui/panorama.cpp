@@ -31,11 +31,15 @@ Panorama::Panorama(std::shared_ptr<Database> database, QWidget* parent) :
 
     QObject::connect(this, SIGNAL(reload()), this, SLOT(doReload()));
     mWorldModel->reload().set([this] {emit reload();});
+
+    QObject::connect(this, SIGNAL(visibilityChanged()), mGLWidget, SLOT(update()));
+    mWorldModel->visibilityChanged().set([this] {emit visibilityChanged();});
 }
 
 Panorama::~Panorama()
 {
     mWorldModel->reload().set(std::function<void()>());
+    mWorldModel->visibilityChanged().set(std::function<void()>());
 }
 
 
@@ -36,6 +36,7 @@ public:
 
 signals:
     void reload();
+    void visibilityChanged();
 
 private slots:
     void doReload();
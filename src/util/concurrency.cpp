@@ -18,6 +18,7 @@
 
 #include "concurrency.hpp"
 
+#include <atomic>
 #include <iostream>
 
 TaskManager TaskManager::manager;
@@ -42,3 +43,43 @@ void TaskManager::launch(const std::function<void()>& f)
     mIOService.post(f);
 }
 
+
+void TaskManager::parallel(const std::vector<std::function<void()>>& jobs)
+{
+    struct State {
+        State(unsigned int count) :
+            claimed(new std::atomic<bool>[count]), remaining(count)
+        {
+            for (unsigned int i = 0 ; i < count ; ++i)
+                claimed[i] = false;
+        }
+
+        std::unique_ptr<std::atomic<bool>[]> claimed;
+        unsigned int remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    unsigned int count = jobs.size();
+    auto state = std::make_shared<State>(count);
+
+    auto run = [state, &jobs] (unsigned int i) {
+        // Late workers find the job already claimed, and must not touch
+        // 'jobs' which may be out of scope.
+        if (state->claimed[i].exchange(true))
+            return;
+        jobs[i]();
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (--state->remaining == 0)
+            state->done.notify_one();
+    };
+
+    for (unsigned int i = 1 ; i < count ; ++i)
+        this->launch([run, i] {run(i);});
+    for (unsigned int i = 0 ; i < count ; ++i)
+        run(i);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state] {return state->remaining == 0;});
+}
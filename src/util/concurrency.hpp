@@ -30,6 +30,12 @@ public:
     static TaskManager manager;
 
     void launch(const std::function<void()>& f);
+    // Run the jobs concurrently and wait for all of them to finish.  Jobs that
+    // no worker has started yet are run by the calling thread, so that nested
+    // calls from tasks of this manager cannot deadlock.
+    void parallel(const std::vector<std::function<void()>>& jobs);
+
+    inline unsigned int threadCount() const;
 
 private:
     TaskManager();
@@ -40,6 +46,9 @@ private:
     std::vector<std::thread> mThreadPool;
 };
 
+inline unsigned int TaskManager::threadCount() const
+    {return mThreadPool.size();}
+
 template <typename T>
 class LockGuarded
 {
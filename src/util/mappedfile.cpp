@@ -0,0 +1,132 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#include "mappedfile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::string& path, bool writable)
+{
+    close();
+
+    mWritable = writable;
+    mFd = writable ? ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644)
+                   : ::open(path.c_str(), O_RDONLY);
+    if (mFd < 0)
+    {
+        std::cerr << "Cannot open file " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(mFd, &st) < 0)
+    {
+        std::cerr << "Cannot stat file " << path << ": " << std::strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+
+    mSize = st.st_size;
+    if (mSize == 0)
+        return true;
+
+    void* data = mmap(nullptr, mSize, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, mFd, 0);
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "Cannot map file " << path << ": " << std::strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    mData = static_cast<char*>(data);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (mData)
+        munmap(mData, mSize);
+    if (mFd >= 0)
+        ::close(mFd);
+    mFd = -1;
+    mData = nullptr;
+    mSize = 0;
+}
+
+bool MappedFile::resize(size_t size)
+{
+    if (mFd < 0 || !mWritable)
+        return false;
+
+    if (mData)
+        munmap(mData, mSize);
+    mData = nullptr;
+    mSize = 0;
+
+    if (ftruncate(mFd, size) < 0)
+    {
+        std::cerr << "Cannot resize mapped file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (size == 0)
+        return true;
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "Cannot map file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    mData = static_cast<char*>(data);
+    mSize = size;
+    return true;
+}
+
+void MappedFile::release(size_t end)
+{
+    // Whole pages only.
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    end -= end % pageSize;
+    if (!mData || end == 0)
+        return;
+
+    if (mWritable)
+        msync(mData, end, MS_SYNC);
+    madvise(mData, end, MADV_DONTNEED);
+}
+
+void MappedFile::prefetch(size_t begin, size_t end) const
+{
+    // Whole pages only.
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    begin -= begin % pageSize;
+    if (!mData || end <= begin)
+        return;
+
+    madvise(mData + begin, end - begin, MADV_WILLNEED);
+}
@@ -0,0 +1,64 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <string>
+
+// File mapped in memory, either read-only or writable and resizable.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map an existing file for reading, or create an empty file for writing.
+    bool open(const std::string& path, bool writable = false);
+    void close();
+
+    // Change the size of a writable file, and map it again.
+    bool resize(size_t size);
+    // Write the bytes before 'end' to the file and drop them from memory.
+    // They are read again from the file if accessed.
+    void release(size_t end);
+    // Read the bytes between 'begin' and 'end' from the file in the
+    // background, before they are accessed.
+    void prefetch(size_t begin, size_t end) const;
+
+    inline const char* data() const;
+    inline char* data();
+    inline size_t size() const;
+
+private:
+    int mFd = -1;
+    bool mWritable = false;
+    char* mData = nullptr;
+    size_t mSize = 0;
+};
+
+inline const char* MappedFile::data() const
+    {return mData;}
+inline char* MappedFile::data()
+    {return mData;}
+inline size_t MappedFile::size() const
+    {return mSize;}
+
+#endif
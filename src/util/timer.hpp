@@ -0,0 +1,50 @@
+/*
+    Panoramix - 3D view of your surroundings.
+    Copyright (C) 2017  Guillaume Endignoux
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/gpl-3.0.txt
+*/
+
+#ifndef TIMER_HPP
+#define TIMER_HPP
+
+#include <chrono>
+
+// Wall-clock stopwatch, used to report the duration of geometric stages.
+class Timer
+{
+public:
+    inline Timer();
+
+    inline void restart();
+    // Seconds elapsed since construction or last restart.
+    inline double elapsed() const;
+    // Return elapsed() and restart.
+    inline double lap();
+
+private:
+    std::chrono::steady_clock::time_point mStart;
+};
+
+inline Timer::Timer() :
+    mStart(std::chrono::steady_clock::now()) {}
+
+inline void Timer::restart()
+    {mStart = std::chrono::steady_clock::now();}
+inline double Timer::elapsed() const
+    {return std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();}
+inline double Timer::lap()
+    {double t = elapsed(); restart(); return t;}
+
+#endif